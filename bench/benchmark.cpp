@@ -0,0 +1,477 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+ // benchmark for every stage of the pipeline, on a corpus generated from a seed so two runs see the same bytes.
+ // text output for people, --json (one object per line) for scripts that watch for regressions.
+
+// include header
+#include "include/compressor.h"
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#ifdef _WIN32
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+
+struct BenchOptions {
+    size_t size = 8 << 20; // bytes per corpus kind.
+    size_t tiny_files = 2000;
+    int reps = 3; // best of.
+    uint32_t seed = 1;
+    bool json = false;
+    bool keep = false; // leave the corpus on disk.
+    fs::path dir;
+    PackOptions pack;
+};
+
+struct Corpus { // one kind of data, as the files it would be on disk.
+    std::string kind;
+    std::vector<std::vector<uint8_t>> files;
+};
+
+// corpus generation
+
+std::string Word(std::mt19937& gen) { // short words are common, long ones rare, a bit like real text.
+    static const char* words[] = { "the", "of", "and", "to", "in", "is", "for", "that", "with", "on", "file", "archive",
+        "block", "data", "stream", "compress", "folder", "window", "match", "offset", "length", "literal", "table",
+        "entropy", "header", "directory", "checksum", "worker", "thread", "buffer", "memory", "performance" };
+    std::geometric_distribution<size_t> pick(0.12);
+    return words[std::min(pick(gen), std::size(words) - 1)];
+}
+
+std::vector<uint8_t> MakeText(std::mt19937& gen, size_t size) {
+    std::string out;
+    while (out.size() < size) {
+        size_t n = 5 + gen() % 15;
+        for (size_t i = 0; i < n; ++i) {
+            std::string w = Word(gen);
+            if (i == 0)
+                w[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(w[0])));
+            out += w;
+            out += (i + 1 < n) ? " " : ".\n";
+        }
+    }
+    out.resize(size);
+    return std::vector<uint8_t>(out.begin(), out.end());
+}
+
+std::vector<uint8_t> MakeLog(std::mt19937& gen, size_t size) {
+    static const char* levels[] = { "INFO", "INFO", "INFO", "DEBUG", "WARN", "ERROR" };
+    static const char* paths[] = { "/api/v1/files", "/api/v1/archive", "/health", "/api/v1/extract", "/metrics" };
+    std::string out;
+    uint64_t ms = 1700000000000ull;
+    char line[256];
+    while (out.size() < size) {
+        ms += gen() % 50;
+        // one draw per statement, argument order is up to the compiler and the corpus has to be the same everywhere.
+        const char* level = levels[gen() % std::size(levels)];
+        unsigned worker = static_cast<unsigned>(gen() % 16);
+        unsigned id = static_cast<unsigned>(gen());
+        const char* path = paths[gen() % std::size(paths)];
+        unsigned status = (gen() % 20) ? 200u : 500u;
+        unsigned took = static_cast<unsigned>(gen() % 900);
+        int len = std::snprintf(line, sizeof(line), "%llu %s [worker-%u] request id=%08x path=%s status=%u took=%ums\n",
+            static_cast<unsigned long long>(ms), level, worker, id, path, status, took);
+        out.append(line, static_cast<size_t>(len));
+    }
+    out.resize(size);
+    return std::vector<uint8_t>(out.begin(), out.end());
+}
+
+std::vector<uint8_t> MakeBinary(std::mt19937& gen, size_t size) { // code-like runs, pointer tables, padding and some noise.
+    std::vector<uint8_t> out;
+    out.reserve(size);
+    std::vector<std::vector<uint8_t>> snippets(64);
+    for (auto& s : snippets) {
+        s.resize(4 + gen() % 28);
+        for (auto& b : s)
+            b = static_cast<uint8_t>(gen() % 64 < 40 ? gen() % 16 : gen());
+    }
+    uint64_t pointer = 0x140001000ull;
+    while (out.size() < size) {
+        switch (gen() % 8) {
+        case 0: // pointer table.
+            for (size_t i = 0, n = 8 + gen() % 64; i < n; ++i) {
+                pointer += 16 + gen() % 256;
+                PutLE(out, pointer, 8);
+            }
+            break;
+        case 1: // padding.
+            out.insert(out.end(), gen() % 512, 0);
+            break;
+        case 2: // noise, constants and such.
+            for (size_t i = 0, n = gen() % 128; i < n; ++i)
+                out.push_back(static_cast<uint8_t>(gen()));
+            break;
+        default: { // instruction-ish snippets.
+            const auto& s = snippets[gen() % snippets.size()];
+            out.insert(out.end(), s.begin(), s.end());
+            PutLE(out, gen() % 4096, 4);
+        }
+        }
+    }
+    out.resize(size);
+    return out;
+}
+
+std::vector<uint8_t> MakeCompressed(std::mt19937& gen, size_t size) { // deflated text, what zips and media look like to us.
+    std::vector<uint8_t> out;
+    out.reserve(size);
+    while (out.size() < size) {
+        auto chunk = E_Entropy(MakeText(gen, 256 << 10), 9);
+        out.insert(out.end(), chunk.begin(), chunk.end());
+    }
+    out.resize(size);
+    return out;
+}
+
+// a slow start, then fast data. random ACGT keeps the match finder busy for a while, random bytes are stored right
+// away. a pipeline that lets the fast blocks run ahead of the slow ones shows it in the peak memory of this kind.
+std::vector<uint8_t> MakeSkewed(std::mt19937& gen, size_t size) {
+    std::vector<uint8_t> out(size);
+    size_t slow = size / 16;
+    for (size_t i = 0; i < size; ++i)
+        out[i] = i < slow ? "ACGT"[gen() % 4] : static_cast<uint8_t>(gen());
+    return out;
+}
+
+std::vector<Corpus> MakeCorpus(const BenchOptions& options) {
+    std::mt19937 gen(options.seed);
+    std::vector<Corpus> corpus;
+    corpus.push_back({ "text", { MakeText(gen, options.size) } });
+    corpus.push_back({ "logs", { MakeLog(gen, options.size) } });
+    corpus.push_back({ "binary", { MakeBinary(gen, options.size) } });
+    corpus.push_back({ "compressed", { MakeCompressed(gen, options.size) } });
+    corpus.push_back({ "skewed", { MakeSkewed(gen, options.size) } });
+    Corpus tiny{ "tiny", {} };
+    for (size_t i = 0; i < options.tiny_files; ++i) {
+        size_t n = 16 + gen() % 1024;
+        tiny.files.push_back(gen() % 2 ? MakeText(gen, n) : MakeLog(gen, n));
+    }
+    corpus.push_back(std::move(tiny));
+    return corpus;
+}
+
+fs::path CorpusFile(const Corpus& corpus, const fs::path& folder, size_t i) { // a few directories, like a real tree.
+    return folder / ("d" + std::to_string(i % 16)) / (corpus.kind + "_" + std::to_string(i) + ".dat");
+}
+
+void WriteCorpus(const Corpus& corpus, const fs::path& folder) {
+    for (size_t i = 0; i < corpus.files.size(); ++i) {
+        fs::path file = CorpusFile(corpus, folder, i);
+        fs::create_directories(file.parent_path());
+        Write(file.string(), corpus.files[i]);
+    }
+}
+
+// measuring
+
+uint64_t PeakRssKb() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize / 1024;
+#elif defined(__linux__)
+    std::ifstream status("/proc/self/status"); // VmHWM, the one clear_refs resets.
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmHWM:", 0) == 0)
+            return std::strtoull(line.c_str() + 6, nullptr, 10);
+    }
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return static_cast<uint64_t>(usage.ru_maxrss) / 1024; // bytes there.
+#else
+    return static_cast<uint64_t>(usage.ru_maxrss);
+#endif
+#endif
+}
+
+void ResetPeakRss() { // linux lets us restart the high-water mark, so every stage gets its own peak. elsewhere it only grows.
+#ifdef __linux__
+    std::ofstream("/proc/self/clear_refs") << "5";
+#endif
+}
+
+struct Result {
+    std::string kind, stage;
+    uint64_t raw_bytes = 0; // the uncompressed size the stage stands for, speeds are measured against it.
+    uint64_t in_bytes = 0, out_bytes = 0;
+    double seconds = 0;
+    uint64_t peak_rss_kb = 0;
+};
+
+void Report(const Result& r, const BenchOptions& options) {
+    double mb_s = r.seconds > 0 ? r.raw_bytes / 1048576.0 / r.seconds : 0.0;
+    double ratio = r.in_bytes ? static_cast<double>(r.out_bytes) / r.in_bytes : 0.0;
+    if (options.json) {
+        std::printf("{\"kind\":\"%s\",\"stage\":\"%s\",\"raw_bytes\":%llu,\"in_bytes\":%llu,\"out_bytes\":%llu,"
+            "\"seconds\":%.6f,\"mb_s\":%.2f,\"ratio\":%.4f,\"peak_rss_kb\":%llu,\"jobs\":%zu,\"level\":%d}\n",
+            r.kind.c_str(), r.stage.c_str(), static_cast<unsigned long long>(r.raw_bytes),
+            static_cast<unsigned long long>(r.in_bytes), static_cast<unsigned long long>(r.out_bytes), r.seconds, mb_s, ratio,
+            static_cast<unsigned long long>(r.peak_rss_kb), options.pack.jobs, options.pack.level);
+    }
+    else {
+        std::printf("%-11s %-15s %12llu %12llu %10.2f %8.2f%% %10llu\n", r.kind.c_str(), r.stage.c_str(),
+            static_cast<unsigned long long>(r.in_bytes), static_cast<unsigned long long>(r.out_bytes), mb_s, 100.0 * ratio,
+            static_cast<unsigned long long>(r.peak_rss_kb));
+    }
+    std::fflush(stdout);
+}
+
+// runs 'fn' reps times and keeps the fastest. 'fn' returns the output size.
+Result Measure(const std::string& kind, const std::string& stage, uint64_t raw_bytes, uint64_t in_bytes,
+    const BenchOptions& options, const std::function<uint64_t()>& fn) {
+    Result r{ kind, stage, raw_bytes, in_bytes };
+    r.seconds = 1e300;
+    ResetPeakRss();
+    for (int rep = 0; rep < std::max(options.reps, 1); ++rep) {
+        auto start = std::chrono::steady_clock::now();
+        r.out_bytes = fn();
+        r.seconds = std::min(r.seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    r.peak_rss_kb = PeakRssKb();
+    Report(r, options);
+    return r;
+}
+
+uint64_t TreeSize(const fs::path& folder) {
+    uint64_t total = 0;
+    for (auto& p : fs::recursive_directory_iterator(folder)) {
+        if (fs::is_regular_file(p))
+            total += fs::file_size(p);
+    }
+    return total;
+}
+
+class Quiet { // the extractors report every file on cout, that would drown the report.
+public:
+    Quiet() : saved_(std::cout.rdbuf(sink_.rdbuf())) {}
+    ~Quiet() { std::cout.rdbuf(saved_); }
+private:
+    std::ostringstream sink_;
+    std::streambuf* saved_;
+};
+
+void BenchKind(const Corpus& corpus, const BenchOptions& options) {
+    const std::vector<uint8_t> key = { 0x3a, 0x91, 0x5c, 0x07, 0xe2, 0x44, 0xb8, 0x1f, 0x60, 0xd3, 0x2e, 0x79, 0x85, 0xca, 0x16, 0xfb };
+    const int level = options.pack.level;
+    // buffer stages run one thread over the pieces the pipeline would hand them: stream blocks, or whole small files.
+    std::vector<ByteView> pieces;
+    uint64_t raw = 0;
+    for (const auto& file : corpus.files) {
+        for (size_t at = 0; at < file.size(); at += BLOCK_SIZE)
+            pieces.push_back(ByteView(file).subspan(at, std::min(BLOCK_SIZE, file.size() - at)));
+        raw += file.size();
+    }
+    std::vector<std::vector<uint8_t>> lzss(pieces.size()), zlib(pieces.size()), huff(pieces.size());
+    uint64_t lzss_bytes = 0, zlib_bytes = 0, huff_bytes = 0;
+    for (size_t i = 0; i < pieces.size(); ++i) {
+        lzss[i] = Compress(std::vector<uint8_t>(pieces[i].begin(), pieces[i].end()), level);
+        zlib[i] = E_Entropy(lzss[i], level);
+        huff[i] = HuffEncodeTokens(lzss[i]);
+        lzss_bytes += lzss[i].size();
+        zlib_bytes += zlib[i].size();
+        huff_bytes += huff[i].size();
+    }
+    std::vector<std::vector<uint8_t>> inputs(pieces.size());
+    for (size_t i = 0; i < pieces.size(); ++i)
+        inputs[i].assign(pieces[i].begin(), pieces[i].end());
+
+    Measure(corpus.kind, "lzss_compress", raw, raw, options, [&]() {
+        uint64_t out = 0;
+        for (const auto& in : inputs)
+            out += Compress(in, level).size();
+        return out;
+        });
+    Measure(corpus.kind, "lzss_decompress", raw, lzss_bytes, options, [&]() {
+        uint64_t out = 0;
+        for (const auto& in : lzss)
+            out += Decompress(in).size();
+        return out;
+        });
+    Measure(corpus.kind, "zlib_compress", raw, lzss_bytes, options, [&]() {
+        uint64_t out = 0;
+        for (const auto& in : lzss)
+            out += E_Entropy(in, level).size();
+        return out;
+        });
+    Measure(corpus.kind, "zlib_decompress", raw, zlib_bytes, options, [&]() {
+        uint64_t out = 0;
+        for (size_t i = 0; i < zlib.size(); ++i)
+            out += D_Entropy(zlib[i], lzss[i].size()).size();
+        return out;
+        });
+    Measure(corpus.kind, "huff_encode", raw, lzss_bytes, options, [&]() {
+        uint64_t out = 0;
+        for (const auto& in : lzss)
+            out += HuffEncodeTokens(in).size();
+        return out;
+        });
+    Measure(corpus.kind, "huff_decode", raw, huff_bytes, options, [&]() { // tokens and matches in one go.
+        std::vector<uint8_t> out(BLOCK_SIZE);
+        uint64_t total = 0;
+        for (size_t i = 0; i < huff.size(); ++i)
+            total += HuffDecodeInto(huff[i], out.data(), pieces[i].size());
+        return total;
+        });
+    Measure(corpus.kind, "xor", raw, raw, options, [&]() {
+        uint64_t out = 0;
+        for (const auto& in : inputs)
+            out += a_xor(in, key).size();
+        return out;
+        });
+
+    // round trips through the files on disk, with the worker pool.
+    fs::path source = options.dir / corpus.kind;
+    WriteCorpus(corpus, source);
+    fs::path archive = options.dir / (corpus.kind + ".arc");
+    fs::path out = options.dir / (corpus.kind + ".out");
+    Measure(corpus.kind, "folder_write", raw, raw, options, [&]() {
+        WriteFolderArchive(source, archive.string(), key, options.pack);
+        return static_cast<uint64_t>(fs::file_size(archive));
+        });
+    uint64_t archive_size = fs::file_size(archive);
+    Measure(corpus.kind, "folder_extract", raw, archive_size, options, [&]() {
+        Quiet quiet;
+        fs::remove_all(out);
+        ExtractFolder(archive.string(), out, "", options.pack);
+        return TreeSize(out);
+        });
+    fs::remove_all(out);
+    Measure(corpus.kind, "legacy_build", raw, raw, options, [&]() {
+        auto data = BuildFolderArchive(source, key, options.pack);
+        Write(archive.string(), data);
+        return static_cast<uint64_t>(data.size());
+        });
+    archive_size = fs::file_size(archive);
+    Measure(corpus.kind, "legacy_extract", raw, archive_size, options, [&]() {
+        Quiet quiet;
+        fs::remove_all(out);
+        ExtractFolderArchive(archive.string(), out);
+        return TreeSize(out);
+        });
+    fs::remove_all(out);
+    if (corpus.files.size() == 1) { // one big file, the streamed single-file archive too.
+        fs::path file = CorpusFile(corpus, source, 0);
+        Measure(corpus.kind, "file_write", raw, raw, options, [&]() {
+            BuildFileArchiveStream(file.string(), archive.string(), key, options.pack);
+            return static_cast<uint64_t>(fs::file_size(archive));
+            });
+        archive_size = fs::file_size(archive);
+        Measure(corpus.kind, "file_extract", raw, archive_size, options, [&]() {
+            ExtractFile(archive.string(), out.string(), options.pack);
+            return static_cast<uint64_t>(fs::file_size(out));
+            });
+        fs::remove(out);
+    }
+    fs::remove(archive);
+}
+
+void usage(const std::string& prog) {
+    std::cerr << "  Usage:\n"
+        << "  " << prog << " [options]\n"
+        << "    (Generates a corpus and times every stage of the pipeline on it.)\n"
+        << "  " << " \n"
+        << "    -size <MB>     corpus size per kind, default 8.\n"
+        << "    -tiny <n>      number of tiny files, default 2000.\n"
+        << "    -reps <n>      repetitions per stage, the fastest counts. default 3.\n"
+        << "    -seed <n>      corpus seed, default 1.\n"
+        << "    -kind <name>   only one kind: text, logs, binary, compressed, skewed, tiny.\n"
+        << "    -dir <path>    where the corpus and archives go, default a temp folder.\n"
+        << "    -keep          leave the corpus on disk.\n"
+        << "    -json          one JSON object per line instead of the table.\n"
+        << "    -j <n>         worker threads for the archive round trips.\n"
+        << "    -1 .. -9       compression level, default -6.\n"
+        << "    -solid         folder archives group small files, as filepacker -solid.\n"
+        << "    -chunks        folder archives dedup content-defined chunks, as filepacker -chunks.\n";
+}
+
+int main(int argc, char* argv[]) {
+    BenchOptions options;
+    std::string only;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) == 0 && arg.size() > 2)
+            arg.erase(0, 1);
+        bool has_value = i + 1 < argc;
+        if (arg == "-size" && has_value)
+            options.size = static_cast<size_t>(std::max(1, std::atoi(argv[++i]))) << 20;
+        else if (arg == "-tiny" && has_value)
+            options.tiny_files = static_cast<size_t>(std::max(0, std::atoi(argv[++i])));
+        else if (arg == "-reps" && has_value)
+            options.reps = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "-seed" && has_value)
+            options.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else if (arg == "-kind" && has_value)
+            only = argv[++i];
+        else if (arg == "-dir" && has_value)
+            options.dir = argv[++i];
+        else if (arg == "-keep")
+            options.keep = true;
+        else if (arg == "-json")
+            options.json = true;
+        else if (arg == "-j" && has_value)
+            options.pack.jobs = std::max(1, std::atoi(argv[++i]));
+        else if (arg.size() == 2 && arg[0] == '-' && arg[1] >= '1' && arg[1] <= '9')
+            options.pack.level = arg[1] - '0';
+        else if (arg == "-solid")
+            options.pack.solid = true;
+        else if (arg == "-chunks")
+            options.pack.chunks = true;
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    try {
+        if (options.dir.empty())
+            options.dir = fs::temp_directory_path();
+        options.dir /= "filepacker_bench_" + std::to_string(options.seed); // always a folder of our own, it gets wiped.
+        fs::remove_all(options.dir);
+        fs::create_directories(options.dir);
+        auto corpus = MakeCorpus(options);
+        if (!options.json) {
+            std::printf("level -%d, %zu jobs, best of %d. speeds are MB/s of raw data, ratio is out / in.\n",
+                options.pack.level, options.pack.jobs, options.reps);
+            std::printf("%-11s %-15s %12s %12s %10s %9s %10s\n", "kind", "stage", "in", "out", "MB/s", "ratio", "peak KB");
+        }
+        size_t ran = 0;
+        for (const auto& kind : corpus) {
+            if (!only.empty() && kind.kind != only)
+                continue;
+            BenchKind(kind, options);
+            ran++;
+        }
+        if (!options.keep)
+            fs::remove_all(options.dir);
+        if (ran == 0)
+            throw std::runtime_error("unknown kind '" + only + "'.");
+    }
+    catch (const std::exception& ex) {
+        std::cerr << "\nError: " << ex.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
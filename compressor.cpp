@@ -40,112 +40,305 @@ void usage(const std::string& prog) {
         << "  " << prog << " d <input> <output> (-folder|-file) [key]\n"
         << "    (Decrypt and decompress. Use -folder for folder archives, -file for file archives.)\n"
         << "  " << " \n"
+        << "  " << "Options (anywhere after the archive type):\n"
+        << "    -j <n>     worker threads, defaults to the number of cores.\n"
+        << "    -1 .. -9   compression level, -1 is fastest, -9 is smallest. default -6.\n"
+        << "    -only <glob>  extract only the matching folder entries ('*', '**', '?').\n"
+        << "    -mode <m>  block coding: auto (default, probes every block), huff, both (lzss+zlib), lzss, zlib or store.\n"
+        << "    -chunks    folder archives: content-defined chunks, so files that differ a little still share data.\n"
+        << "    -solid     folder archives: compress files up to 64 KiB together, files up to 4 KiB always are.\n"
+        << "    -readers <n>  folder archives: threads reading files ahead of the workers, default 2. more helps on network storage.\n"
+        << "    -window <m>  long-range matches up to <m> MiB back, or 'max' (1 GiB). file archives use blocks that big, more\n"
+        << "               memory and fewer blocks in parallel. folder archives match within their 1 MiB blocks.\n"
+        << "    -q         quiet, no progress bar and no line per extracted file.\n"
+        << "    -stats     report the time spent in lzss, zlib, xor and io, match counts and ratios.\n"
+        << "  " << " \n"
+        << "  " << prog << " u <folder> <archive> [options] [key]\n"
+        << "    (Update a folder archive in place: unchanged files keep their compressed data, only new or changed\n"
+        << "     files are compressed. Keeps the archive's key unless a new one is given.)\n"
+        << "  " << " \n"
+        << "  " << prog << " l <archive>\n"
+        << "    (List the entries of a folder archive without decoding anything.)\n"
+        << "  " << " \n"
+        << "  " << prog << " t <archive> [-j <n>] [-q]\n"
+        << "    (Test an archive: decode everything and check the block and file checksums, nothing is written.)\n"
+        << "  " << " \n"
+        << "  " << prog << " b <input> [options]\n"
+        << "    (Compress the input at every level and report speed and ratio, nothing is written.)\n"
+        << "  " << " \n"
         << "    -----------------------------------------------------------------------------------\n"
         << "    Made by : Alnicke\n"
         << "    Shared : thanks to zlib, lzss, xor.\n";
 }
 
+// level report, 'b' mode.
+void ReportLevels(const std::string& input_path, const PackOptions& options) {
+    std::ifstream in(input_path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Error opening file: " + input_path);
+    std::vector<std::vector<uint8_t>> blocks; // sample up to 64 blocks, enough to be representative.
+    uint64_t input_size = 0;
+    while (blocks.size() < 64) {
+        std::vector<uint8_t> block(BLOCK_SIZE);
+        in.read(reinterpret_cast<char*>(block.data()), block.size());
+        block.resize(static_cast<size_t>(in.gcount()));
+        if (block.empty())
+            break;
+        input_size += block.size();
+        blocks.push_back(std::move(block));
+    }
+    std::cout << "level   lzss MB/s   total MB/s   lzss ratio   total ratio   (lzss speed is per core)\n";
+    for (int level = 1; level <= 9; level++) {
+        PackStats stats; // the blocks go through the real pipeline, the counters split it into stages.
+        PackOptions level_options = options;
+        level_options.level = level;
+        level_options.stats = &stats;
+        auto start = std::chrono::steady_clock::now();
+        ParallelFor(blocks.size(), options.jobs, [&](size_t i) {
+            E_CompressBlock(blocks[i], level_options);
+            });
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double lzss_seconds = stats.lzss_ns / 1e9;
+        uint64_t lzss_total = stats.lzss_bytes, total = stats.entropy_bytes;
+        double mb = input_size / 1048576.0;
+        std::printf("  -%d   %9.2f   %10.2f   %9.2f%%   %10.2f%%\n", level,
+            lzss_seconds > 0 ? mb / lzss_seconds : 0.0,
+            seconds > 0 ? mb / seconds : 0.0,
+            input_size ? 100.0 * lzss_total / input_size : 0.0,
+            input_size ? 100.0 * total / input_size : 0.0);
+    }
+}
+
 // ep
 int main(int argc, char* argv[]) {
-    if (argc < 5) {
+    if (argc >= 3 && std::string(argv[1]) == "b") {
+        PackOptions options;
+        for (int i = 3; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-j" && i + 1 < argc)
+                options.jobs = std::max(1, std::atoi(argv[++i]));
+        }
+        try {
+            ReportLevels(argv[2], options);
+        }
+        catch (const std::exception& ex) {
+            std::cerr << "\nError: " << ex.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (argc == 3 && std::string(argv[1]) == "l") {
+        try {
+            ListArchive(argv[2]);
+        }
+        catch (const std::exception& ex) {
+            std::cerr << "\nError: " << ex.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    if (argc >= 3 && std::string(argv[1]) == "t") {
+        PackOptions options;
+        PackStats stats;
+        options.stats = &stats;
+        for (int i = 3; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg == "-j" && i + 1 < argc)
+                options.jobs = std::max(1, std::atoi(argv[++i]));
+            else if (arg == "-q")
+                options.quiet = true;
+        }
+        std::optional<ProgressMeter> meter;
+        try {
+            meter.emplace(stats, !options.quiet);
+            VerifySummary summary = VerifyArchive(argv[2], options);
+            meter.reset();
+            std::cout << "Verified: " << summary.entries << " entries, " << summary.blocks << " blocks, "
+                << summary.raw_bytes << " bytes.\n";
+            if (summary.unchecked)
+                std::cout << "Note: " << summary.unchecked << " blocks predate checksums, only their sizes were checked.\n";
+            std::cout << "Archive is OK.\n";
+        }
+        catch (const std::exception& ex) {
+            meter.reset();
+            std::cerr << "\nError: " << ex.what() << "\n";
+            return 1;
+        }
+        return 0;
+    }
+    std::string mode = argv[1]; // Compress or decompress modes.
+    if (argc < 5 && !(argc == 4 && mode == "u")) {
         usage(argv[0]);
         return 1; // finish cuz bad arg.
     }
-    std::string mode = argv[1]; // Compress or decompress modes.
     std::string input_path = argv[2];
     std::string output_path = argv[3];
-    std::string archive_Type = argv[4];
     bool force_folder = false, force_file = false;
-    if (archive_Type == "-folder") // folder archive or??
-        force_folder = true;
-    else if (archive_Type == "-file") // file archive.
-        force_file = true;
+    int first_option = 5;
+    if (mode == "u")
+        first_option = 4; // no archive type, only folder archives can be updated.
     else {
-        usage(argv[0]); // example usages.
-        return 1; // finish.
+        std::string archive_Type = argv[4];
+        if (archive_Type == "-folder") // folder archive or??
+            force_folder = true;
+        else if (archive_Type == "-file") // file archive.
+            force_file = true;
+        else {
+            usage(argv[0]); // example usages.
+            return 1; // finish.
+        }
     }
-    std::vector<uint8_t> key;
-    if (argc >= 6) {
-        std::string key_string = argv[5]; // optional key.
-        if (key_string.empty()) // if its empty generate a new one with size : 16.
-            key = generate_key(16);
-        else
-            key.assign(key_string.begin(), key_string.end());
+    PackOptions options;
+    PackStats stats;
+    options.stats = &stats;
+    bool show_stats = false;
+    std::string key_string;
+    bool has_key = false;
+    for (int i = first_option; i < argc; i++) { // options first, whatever is left is the key.
+        std::string arg = argv[i];
+        if (arg.rfind("--", 0) == 0 && arg.size() > 2)
+            arg.erase(0, 1); // --only and -only are the same thing.
+        if (arg == "-j" && i + 1 < argc) {
+            options.jobs = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg.size() > 2 && arg.rfind("-j", 0) == 0 && std::isdigit(static_cast<unsigned char>(arg[2]))) {
+            options.jobs = std::max(1, std::atoi(arg.c_str() + 2));
+        }
+        else if (arg == "-only" && i + 1 < argc) {
+            options.only = argv[++i];
+        }
+        else if (arg == "-mode" && i + 1 < argc) {
+            std::string name = argv[++i];
+            if (name == "auto")
+                options.mode = MODE_AUTO;
+            else if (name == "huff")
+                options.mode = BLOCK_HUFF;
+            else if (name == "both")
+                options.mode = BLOCK_BOTH;
+            else if (name == "lzss")
+                options.mode = BLOCK_LZSS;
+            else if (name == "zlib")
+                options.mode = BLOCK_ZLIB;
+            else if (name == "store")
+                options.mode = BLOCK_STORED;
+            else {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "-q") {
+            options.quiet = true;
+        }
+        else if (arg == "-chunks") {
+            options.chunks = true;
+        }
+        else if (arg == "-solid") {
+            options.solid = true;
+        }
+        else if (arg == "-readers" && i + 1 < argc) {
+            options.readers = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (arg == "-window" && i + 1 < argc) {
+            std::string size = argv[++i];
+            uint64_t mib = size == "max" ? LONG_WINDOW_MAX >> 20 : std::strtoull(size.c_str(), nullptr, 10);
+            if (mib == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            options.window = std::min(mib, LONG_WINDOW_MAX >> 20) << 20;
+        }
+        else if (arg == "-stats") {
+            show_stats = true;
+        }
+        else if (arg.size() == 2 && arg[0] == '-' && arg[1] >= '1' && arg[1] <= '9') {
+            options.level = arg[1] - '0';
+        }
+        else if (!has_key) {
+            key_string = arg; // optional key.
+            has_key = true;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
     }
-    else {
+    std::vector<uint8_t> key;
+    if (key_string.empty() && mode != "u") // if its empty generate a new one with size : 16.
         key = generate_key(16); // key generation, size : 16
-    }
+    else
+        key.assign(key_string.begin(), key_string.end());
+    auto start = std::chrono::steady_clock::now();
+    std::optional<ProgressMeter> meter; // driven by the bytes the pipeline moves, gone before anything else is printed.
     try {
         if (mode == "c") {
-            size_t input_size = 0;
-            std::vector<uint8_t> archive;
+            uint64_t input_size = 0, archive_size = 0;
             if (force_folder || (fs::is_directory(input_path) && !force_file)) { // check if its a folder. [ref 1]
                 std::cout << "Compressing folder: " << input_path << "\n";
-                archive = BuildFolderArchive(fs::path(input_path), key); // construction.
-                input_size = 0;
-                for (auto& p : fs::recursive_directory_iterator(input_path)) {
-                    if (fs::is_regular_file(p))
-                        input_size += fs::file_size(p);
-                }
+                meter.emplace(stats, !options.quiet);
+                WriteFolderArchive(fs::path(input_path), output_path, key, options); // construction, straight to disk.
+                meter.reset();
+                archive_size = fs::file_size(output_path);
+                input_size = stats.total; // the archiver already summed the file sizes.
             }
             else { // else its a file, so proceed on file compression. [look at 'ref 1']
                 std::cout << "Compressing file: " << input_path << "\n";
-                std::vector<uint8_t> file_data = Read(input_path); // read the file.
-                input_size = file_data.size(); // get the size.
-                archive = BuildFileArchive(file_data, key); // construct the file archive, compression.
+                input_size = fs::file_size(input_path); // get the size.
+                meter.emplace(stats, !options.quiet);
+                BuildFileArchiveStream(input_path, output_path, key, options); // block by block, straight to disk.
+                meter.reset();
+                archive_size = fs::file_size(output_path);
             }
-            Write(output_path, archive); // write to disk.
-            double compression_rate = (input_size > 0) ? (100.0 * (1.0 - (double)archive.size() / input_size)) : 0.0; // calculate compression rate.
-            std::cout << "Archive size: " << archive.size() << " bytes, "
+            double compression_rate = (input_size > 0) ? (100.0 * (1.0 - (double)archive_size / input_size)) : 0.0; // calculate compression rate.
+            std::cout << "Archive size: " << archive_size << " bytes, "
                 << "Original size: " << input_size << " bytes, "
                 << "Compression rate: " << compression_rate << "%\n";
-            for (int i = 0; i <= 100; i++) {
-                Progress(i, 100); // progress indicator, cool shit but useless.
-            }
-            std::cout << "\nCompression complete.\n";
+            std::cout << "Compression complete.\n";
+        }
+        else if (mode == "u") {
+            std::cout << "Updating archive: " << output_path << " from " << input_path << "\n";
+            meter.emplace(stats, !options.quiet);
+            UpdateSummary summary = UpdateFolderArchive(fs::path(input_path), output_path, key, options); // empty key keeps the old one.
+            meter.reset();
+            std::cout << "Reused: " << summary.reused << ", compressed: " << summary.packed << ", removed: " << summary.removed << "\n";
+            std::cout << "Archive size: " << fs::file_size(output_path) << " bytes, Original size: " << stats.total << " bytes\n";
+            std::cout << "Update complete.\n";
         }
         else if (mode == "d") {
+            meter.emplace(stats, !options.quiet);
             if (force_folder) {
                 std::cout << "Extracting folder archive...\n";
                 fs::path out_folder(output_path); // making the output folder, preparing it.
                 fs::create_directories(out_folder); // prepared.
-                ExtractFolderArchive(input_path, out_folder); // extract and store the extracted on new folder.
+                ExtractFolder(input_path, out_folder, options.only, options); // extract and store the extracted on new folder.
+                meter.reset();
                 std::cout << "Folder extraction complete to " << output_path << "\n";
             }
             else if (force_file) {
                 std::cout << "Extracting file archive...\n";
-                std::vector<uint8_t> file_data = ExtractFileArchive(input_path, key); // extract the file.
-                Write(output_path, file_data); // write it to disk.
+                ExtractFile(input_path, output_path, options); // extract the file, write it to disk.
+                meter.reset();
                 std::cout << "File extraction complete to " << output_path << "\n";
             }
             else {
-                std::vector<uint8_t> archive = Read(input_path); // read the archive
-                std::vector<uint8_t> xheaderKey;
-                bool folder_status = false;
-                {
-                    std::vector<uint8_t> temp = archive;
-                    Readarchiveheader(temp, xheaderKey, folder_status); // get the enckey from header.
-                }
-                if (folder_status) {
+                uint8_t flags = ArchiveFlags(input_path); // only the header is read.
+                if (flags & FOLDER_FLAG) {
                     // extracting the resolved data(s) to folder.
                     std::cout << "Extracting folder archive...\n";
                     fs::path outfolder(output_path);
                     fs::create_directories(outfolder);
-                    ExtractFolderArchive(input_path, outfolder);
+                    ExtractFolder(input_path, outfolder, options.only, options);
+                    meter.reset();
                     std::cout << "Folder extraction complete to " << output_path << "\n";
                 }
                 else {
                     // extracting the resolved data to file.
                     std::cout << "Extracting file archive...\n";
-                    std::vector<uint8_t> file_data = ExtractFileArchive(input_path, key);
-                    Write(output_path, file_data);
+                    ExtractFile(input_path, output_path, options);
+                    meter.reset();
                     std::cout << "File extraction complete to " << output_path << "\n";
                 }
             }
-            for (int i = 0; i <= 100; i++) {
-                Progress(i, 100);
-            }
-            std::cout << "\nDecompression complete.\n";
+            std::cout << "Decompression complete.\n";
         }
         else {
             usage(argv[0]); // show the usage, cuz bad decision/args.
@@ -153,9 +346,12 @@ int main(int argc, char* argv[]) {
         }
     }
     catch (const std::exception& ex) {
+        meter.reset();
         std::cerr << "\nError: " << ex.what() << "\n"; // catch the exceptions.
         return 1; // finish the program.
     }
-    return 1; // finish the program.
+    if (show_stats)
+        PrintStats(stats, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    return 0; // finish the program.
 }
 
@@ -0,0 +1,133 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64)
+#include <nmmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+// includes
+
+// crc32c (castagnoli) of the raw data of every block record. it is the crc the cpu has an instruction for: sse4.2 on
+// x86-64, picked at runtime so the binary still runs on anything older, and the armv8 crc extension when the compiler
+// targets it. everything else takes the table, the result is the same either way.
+constexpr uint32_t CRC32C_POLY = 0x82F63B78; // reflected.
+
+constexpr std::array<std::array<uint32_t, 256>, 8> Crc32cTables() { // slicing by 8.
+    std::array<std::array<uint32_t, 256>, 8> tables{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (CRC32C_POLY & (0u - (crc & 1)));
+        tables[0][i] = crc;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (size_t t = 1; t < 8; ++t)
+            tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+    }
+    return tables;
+}
+
+constexpr std::array<std::array<uint32_t, 256>, 8> CRC32C_TABLES = Crc32cTables();
+
+inline uint32_t Crc32cTable(uint32_t crc, const uint8_t* data, size_t len) { // takes and returns the inverted state.
+    const auto& t = CRC32C_TABLES;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint32_t lo, hi;
+        std::memcpy(&lo, data, 4);
+        std::memcpy(&hi, data + 4, 4);
+        lo ^= crc;
+        crc = t[7][lo & 0xFF] ^ t[6][(lo >> 8) & 0xFF] ^ t[5][(lo >> 16) & 0xFF] ^ t[4][lo >> 24] ^
+            t[3][hi & 0xFF] ^ t[2][(hi >> 8) & 0xFF] ^ t[1][(hi >> 16) & 0xFF] ^ t[0][hi >> 24];
+    }
+    for (; len; ++data, --len)
+        crc = (crc >> 8) ^ t[0][(crc ^ *data) & 0xFF];
+    return crc;
+}
+
+#if defined(__x86_64__) || defined(_M_X64)
+#ifdef _MSC_VER
+#define CRC32C_TARGET
+#else
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#endif
+
+CRC32C_TARGET inline uint32_t Crc32cHardware(uint32_t crc, const uint8_t* data, size_t len) {
+    uint64_t state = crc;
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        state = _mm_crc32_u64(state, word);
+    }
+    uint32_t tail = static_cast<uint32_t>(state);
+    for (; len; ++data, --len)
+        tail = _mm_crc32_u8(tail, *data);
+    return tail;
+}
+
+inline bool CpuHasCrc32c() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] >> 20) & 1;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+inline uint32_t Crc32cHardware(uint32_t crc, const uint8_t* data, size_t len) {
+    for (; len >= 8; data += 8, len -= 8) {
+        uint64_t word;
+        std::memcpy(&word, data, 8);
+        crc = __crc32cd(crc, word);
+    }
+    for (; len; ++data, --len)
+        crc = __crc32cb(crc, *data);
+    return crc;
+}
+
+inline bool CpuHasCrc32c() {
+    return true;
+}
+#else
+inline uint32_t Crc32cHardware(uint32_t crc, const uint8_t* data, size_t len) {
+    return Crc32cTable(crc, data, len);
+}
+
+inline bool CpuHasCrc32c() {
+    return false;
+}
+#endif
+
+// crc32c of 'data', carried on from 'crc' so it can be computed piece by piece. Crc32c(a + b) is
+// Crc32c(b, Crc32c(a)).
+inline uint32_t Crc32c(const uint8_t* data, size_t len, uint32_t crc = 0) {
+    static const bool hardware = CpuHasCrc32c();
+    crc = ~crc;
+    crc = hardware ? Crc32cHardware(crc, data, len) : Crc32cTable(crc, data, len);
+    return ~crc;
+}
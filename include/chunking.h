@@ -0,0 +1,117 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+// includes
+
+// content hashes and chunk boundaries for deduplicating folder archives. hashes only live for one run, nothing here
+// ends up in an archive, so they dont need to be portable across machines.
+constexpr size_t CHUNK_MIN = 64 << 10; // no cut before this, keeps the per-record overhead down.
+constexpr unsigned CHUNK_AVERAGE_BITS = 18; // then a cut every 256 KiB on average.
+
+inline uint64_t RotL64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t Hash64(const uint8_t* data, size_t len, uint64_t seed = 0) { // xxhash64.
+    constexpr uint64_t P1 = 11400714785074694791ull, P2 = 14029467366897019727ull, P3 = 1609587929392839161ull;
+    constexpr uint64_t P4 = 9650029242287828579ull, P5 = 2870177450012600261ull;
+    auto Load64 = [](const uint8_t* p) {
+        uint64_t v;
+        std::memcpy(&v, p, 8);
+        return v;
+        };
+    auto Round = [](uint64_t acc, uint64_t input) {
+        acc += input * P2;
+        return RotL64(acc, 31) * P1;
+        };
+    auto Merge = [&](uint64_t acc, uint64_t value) {
+        acc ^= Round(0, value);
+        return acc * P1 + P4;
+        };
+    const uint8_t* p = data;
+    const uint8_t* end = data + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+        for (; end - p >= 32; p += 32) {
+            v1 = Round(v1, Load64(p));
+            v2 = Round(v2, Load64(p + 8));
+            v3 = Round(v3, Load64(p + 16));
+            v4 = Round(v4, Load64(p + 24));
+        }
+        h = RotL64(v1, 1) + RotL64(v2, 7) + RotL64(v3, 12) + RotL64(v4, 18);
+        h = Merge(Merge(Merge(Merge(h, v1), v2), v3), v4);
+    }
+    else
+        h = seed + P5;
+    h += len;
+    for (; end - p >= 8; p += 8)
+        h = RotL64(h ^ Round(0, Load64(p)), 27) * P1 + P4;
+    if (end - p >= 4) {
+        uint32_t v;
+        std::memcpy(&v, p, 4);
+        h = RotL64(h ^ (v * P1), 23) * P2 + P3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        h = RotL64(h ^ (*p * P5), 11) * P1;
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+}
+
+constexpr std::array<uint64_t, 256> GearTable() { // fixed random values, splitmix64 from a constant seed.
+    std::array<uint64_t, 256> table{};
+    uint64_t state = 0x46696C655061636Bull;
+    for (auto& value : table) {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        value = z ^ (z >> 31);
+    }
+    return table;
+}
+
+constexpr std::array<uint64_t, 256> GEAR = GearTable();
+
+// length of the next content-defined chunk at 'data', at most 'max_size'. a rolling gear hash over the last 64 bytes
+// decides, so an insertion early in a file only moves the cuts around it and the chunks after it still match.
+// 'size' must reach max_size unless the input ends there.
+inline size_t ChunkCut(const uint8_t* data, size_t size, size_t max_size) {
+    constexpr uint64_t mask = ~uint64_t(0) << (64 - CHUNK_AVERAGE_BITS); // top bits, they see the whole window.
+    size_t limit = std::min(size, max_size);
+    if (limit <= CHUNK_MIN)
+        return limit;
+    uint64_t hash = 0;
+    for (size_t i = CHUNK_MIN; i < limit; ++i) {
+        hash = (hash << 1) + GEAR[data[i]];
+        if (!(hash & mask))
+            return i + 1;
+    }
+    return limit;
+}
@@ -21,6 +21,8 @@
  // * Fully usage has given on the program.
  // * big regards, Alnicke.
 
+#pragma once
+
 // includes
 #include <iostream>
 #include <filesystem>
@@ -28,6 +30,32 @@
 #include <random>
 #include <zlib.h>
 #include <thread>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include "checksum.h"
+#include "chunking.h"
+#include "huffman.h"
+#include "kernels.h"
+#include "long_range.h"
+#include "mapped_file.h"
+#include "parallel.h"
+#include "stats.h"
+#include "xor_stream.h"
 // includes
 
 // vars ( compiletime, static ) 
@@ -39,126 +67,286 @@ constexpr size_t MAGIC_SIZE = 4;
 const char MAGIC[MAGIC_SIZE + 1] = "ACOD";
 constexpr uint8_t EKEY = 0xF * 91837596798 ^ 901038597 + 9813798756871379;
 constexpr uint8_t FOLDER_FLAG = 1;
+constexpr uint8_t STREAM_FLAG = 2; // file archive made of independent blocks, see BuildFileArchiveStream.
+constexpr size_t BLOCK_SIZE = 1 << 20; // raw bytes per stream block, keeps memory flat no matter the file size.
+constexpr size_t BLOCK_HEADER_SIZE = 24; // raw size, lzss size, zlib size. all 64-bit, the block mode sits in the top byte of the lzss size.
+constexpr uint8_t INDEXED_FOLDER = FOLDER_FLAG | STREAM_FLAG; // folder archive of block records with a directory at the end.
+constexpr uint8_t INDEX_VERSION = 4; // 2 added the mtime per entry, 3 shared records, 4 solid groups. all are read.
+constexpr size_t INDEX_TRAILER_SIZE = 20; // directory offset, directory size, magic.
+constexpr uint64_t SOLID_FILE_MAX = 64 << 10; // -solid groups files up to this size, bigger ones gain little from a neighbour.
+constexpr uint64_t SOLID_AUTO_MAX = 4 << 10; // files up to this size are grouped without -solid, a record of their own costs more than it saves.
+const char INDEX_MAGIC[MAGIC_SIZE + 1] = "ACDX";
+constexpr uint64_t LONG_WINDOW_MAX = 1ull << 30; // -window max, blocks of a streamed file never get bigger than this.
+constexpr uint64_t LONG_BATCH_BYTES = 256ull << 20; // raw bytes a -window stream keeps in flight, two blocks at least.
 // vars ( compiletime, static )
 
-std::vector<uint8_t> Read(const std::string& file) {
-    std::ifstream f(file, std::ios::binary);
+struct CompressionLevel { // match finder effort, picked with -1 .. -9.
+    size_t depth; // hash chain candidates checked per position.
+    size_t lazy; // how many times a match may be deferred for a longer one at the next byte.
+    size_t nice; // a match this long is good enough, stop searching.
+};
+constexpr CompressionLevel LEVELS[10] = {
+    { 1, 0, 16 }, // 0, unused, same as 1.
+    { 1, 0, 16 }, { 2, 0, 24 }, { 4, 0, 32 },
+    { 8, 1, 32 }, { 16, 1, 64 }, { 32, 1, MAX },
+    { 64, 4, MAX }, { 256, 8, MAX }, { 1024, 16, MAX },
+};
+constexpr int DEFAULT_LEVEL = 6;
+
+enum BlockMode : uint8_t { // what a block record went through, picked per block.
+    BLOCK_BOTH = 0, // lzss then zlib, the only mode older archives know.
+    BLOCK_STORED = 1, // raw bytes, nothing would shrink them.
+    BLOCK_ZLIB = 2, // lzss made it bigger, zlib alone on the raw bytes.
+    BLOCK_LZSS = 3, // zlib couldnt squeeze the tokens, they are kept as they are.
+    BLOCK_HUFF = 4, // lzss tokens huffman coded by us, see huffman.h. one match search, the default.
+    BLOCK_LONG = 5, // long-range matches, see long_range.h, with the bytes between them in an inner record of any mode.
+};
+constexpr uint8_t BLOCK_CHECKSUM = 0x80; // on top of the mode: a crc32c of the raw block ends the record, counted in its size.
+constexpr size_t BLOCK_CHECKSUM_SIZE = 4;
+constexpr int MODE_AUTO = -1; // probe every block and keep whatever is smallest.
+constexpr int ZLIB_RETRY_LEVEL = 8; // from here on auto mode always tries zlib over the tokens and keeps the smaller one.
+constexpr size_t ZLIB_PROBE_SIZE = 64 << 10; // below that level only when zlib -1 on this much of the tokens looks a lot better.
+constexpr double STORE_ENTROPY = 7.9; // bits per byte in the sample, above that the data is compressed already.
+
+struct PackOptions { // knobs coming from the command line.
+    size_t jobs = DefaultJobs(); // worker threads, -j N.
+    int level = DEFAULT_LEVEL; // -1 (fast) .. -9 (small), drives both lzss and zlib.
+    std::string only; // -only <glob>, extract matching folder entries only.
+    int mode = MODE_AUTO; // -mode <auto|huff|both|lzss|zlib|store>, or a BlockMode forced on every block.
+    bool quiet = false; // -q, no progress bar and no line per extracted file.
+    bool chunks = false; // -chunks, content-defined chunks for folder dedup instead of fixed blocks.
+    bool solid = false; // -solid, files of a folder up to SOLID_FILE_MAX are compressed together in groups, not just tiny ones.
+    size_t readers = 2; // -readers N, threads reading folder files ahead of the workers.
+    uint64_t window = 0; // -window <MiB|max>, long-range matches this far back and file blocks this big, 0 is off.
+    PackStats* stats = nullptr; // counters for the progress bar and --stats, when set.
+};
+
+inline std::vector<uint8_t> Read(const std::string& file) { // sized up front, one read for the whole file.
+    std::ifstream f(file, std::ios::binary | std::ios::ate);
     if (!f)
         throw std::runtime_error("Error opening file: " + file);
-    return std::vector<uint8_t>((std::istreambuf_iterator<char>(f)),
-        std::istreambuf_iterator<char>());
+    std::vector<uint8_t> data(static_cast<size_t>(f.tellg()));
+    f.seekg(0);
+    if (!f.read(reinterpret_cast<char*>(data.data()), data.size()))
+        throw std::runtime_error("Error reading file: " + file);
+    return data;
 }
 
-void Write(const std::string& file, const std::vector<uint8_t>& data) {
+inline void Write(const std::string& file, ByteView data) {
     std::ofstream f(file, std::ios::binary);
     if (!f)
         throw std::runtime_error("Error opening file: " + file);
     f.write(reinterpret_cast<const char*>(data.data()), data.size());
 }
 
-void Progress(int p, int total) { // progress indicator, as i said so, its useless. but looks cool.
-    static const char anim[] = "|/-\\";
-    static int frame = 0;
-    int bar_width = 30;
-    int num_dashes = (p * bar_width) / total;
-    int num_spaces = bar_width - num_dashes;
-    std::cout << "\r[" << anim[frame] << "] "
-        << std::string(num_dashes, '-') << p << "%"
-        << std::string(num_spaces, ' ') << " [|]";
-    std::cout.flush();
-    frame = (frame + 1) % 4;
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> dis(600, 999);
-    int wait = dis(gen);
-    std::this_thread::sleep_for(std::chrono::microseconds(wait));
+inline void PutLE(std::vector<uint8_t>& out, uint64_t value, size_t bytes) { // little endian, like every size in the archive.
+    for (size_t i = 0; i < bytes; ++i)
+        out.push_back(static_cast<uint8_t>((value >> (8 * i)) & 0xFF));
 }
 
-std::vector<uint8_t> a_xor(const std::vector<uint8_t>& input, const std::vector<uint8_t>& key) {
-    std::vector<uint8_t> out(input.size()); // better xor.
-    size_t key_len = key.size();
-    for (size_t i = 0; i < input.size(); ++i) {
-        uint8_t m_key = key[i % key_len] ^ static_cast<uint8_t>(i & 0xFF);
-        out[i] = input[i] ^ m_key;
+inline void PutVarint(std::vector<uint8_t>& out, uint64_t value) { // 7 bits a byte, low first, the top bit says more follow.
+    for (; value >= 0x80; value >>= 7)
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+inline uint64_t GetVarint(ByteView in, size_t& pos) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (pos >= in.size())
+            throw std::runtime_error("corrupted archive: truncated varint.");
+        uint8_t byte = in[pos++];
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
     }
-    return out;
+    throw std::runtime_error("corrupted archive: invalid varint.");
 }
 
-std::vector<uint8_t> Compress(const std::vector<uint8_t>& in) { // mixed compression.
-    std::vector<uint8_t> out;
-    const size_t size = in.size();
-    size_t pos = 0;
-    std::vector<uint8_t> literals;
-    std::vector<int> hash_table(65536, -1);
-    auto L_Flush = [&]() {
-        size_t literal_count = literals.size();
-        size_t idx = 0;
-        while (literal_count > 0) {
-            uint8_t count = static_cast<uint8_t>(std::min(literal_count, static_cast<size_t>(127)));
-            out.push_back(count);
-            out.insert(out.end(), literals.begin() + idx, literals.begin() + idx + count);
-            idx += count;
-            literal_count -= count;
-        }
-        literals.clear();
-        };
+inline uint64_t GetLE(const uint8_t* in, size_t bytes) {
+    uint64_t value = 0;
+    for (size_t i = 0; i < bytes; ++i)
+        value |= static_cast<uint64_t>(in[i]) << (8 * i);
+    return value;
+}
 
-    while (pos < size) {
-        size_t matched_len = 0, matched_off = 0;
-        if (pos + MIN <= size) {
-            uint32_t hash = (static_cast<uint32_t>(in[pos]) << 16) |
-                (static_cast<uint32_t>(in[pos + 1]) << 8) |
-                (static_cast<uint32_t>(in[pos + 2]));
-            uint16_t h = static_cast<uint16_t>((hash ^ (hash >> 8)) & 0xFFFF);
-            int candidate = hash_table[h];
-            if (candidate >= 0 && pos - candidate <= WINDOW) {
-                size_t curr_matched_len = 0;
-                while (pos + curr_matched_len < size &&
-                    in[candidate + curr_matched_len] == in[pos + curr_matched_len] &&
-                    curr_matched_len < MAX &&
-                    candidate + curr_matched_len < pos)
-                {
-                    curr_matched_len++;
-                }
-                if (curr_matched_len >= MIN) {
-                    matched_len = curr_matched_len;
-                    matched_off = pos - candidate;
+inline void a_xor_copy(const uint8_t* src, uint8_t* dst, size_t len, const std::vector<uint8_t>& key, uint64_t offset) { // same stream as a_xor, but starting at 'offset'. src may be dst.
+    KeyStreamFor(key).Apply(src, dst, len, offset);
+}
+
+inline void a_xor_inplace(uint8_t* data, size_t len, const std::vector<uint8_t>& key, uint64_t offset) {
+    a_xor_copy(data, data, len, key, offset);
+}
+
+inline std::vector<uint8_t> a_xor(ByteView input, const std::vector<uint8_t>& key) {
+    std::vector<uint8_t> out(input.size()); // better xor.
+    a_xor_copy(input.data(), out.data(), input.size(), key, 0);
+    return out;
+}
+
+// the lzss match finder, keeping its hash chains between calls. positions go in shifted by 'base_' and each call
+// moves the base past everything the last one stored, so old entries fall out of reach without clearing the tables.
+class LzssEncoder {
+public:
+    LzssEncoder() : hash_table_(65536, -1), prev_(WINDOW + 1, -1) {}
+    void Encode(ByteView in, int level, std::vector<uint8_t>& out, PackStats* stats = nullptr) { // out is overwritten.
+        static const Variants variants = CpuHasAvx2() ? MakeVariants<Avx2Kernel>(std::make_index_sequence<10>()) :
+            MakeVariants<WordKernel>(std::make_index_sequence<10>());
+        (this->*variants[std::clamp(level, 1, 9)])(in, out, stats);
+    }
+private:
+    // one copy of the match finder per level and per match length kernel, so depth, lazy and nice are constants and the
+    // branches that dont apply to a level are compiled out. the table is picked once, from what the cpu can do.
+    using Variant = void (LzssEncoder::*)(ByteView, std::vector<uint8_t>&, PackStats*);
+    using Variants = std::array<Variant, 10>;
+    template <typename Kernel, size_t... Levels>
+    static constexpr Variants MakeVariants(std::index_sequence<Levels...>) {
+        return { &LzssEncoder::EncodeLevel<static_cast<int>(Levels), Kernel>... };
+    }
+    template <int Level, typename Kernel>
+    void EncodeLevel(ByteView in, std::vector<uint8_t>& out, PackStats* stats) {
+        constexpr CompressionLevel params = LEVELS[Level];
+        uint64_t matches = 0, match_bytes = 0; // kept local, the shared counters are touched once at the end.
+        const size_t size = in.size();
+        const int64_t base = base_;
+        size_t pos = 0;
+        out.clear();
+        out.reserve(size + size / 127 + 1); // all literals, the worst case.
+        // hash chains: head[] holds the newest position per hash, prev[] links each position to the one before it.
+        std::vector<int64_t>& hash_table = hash_table_;
+        std::vector<int64_t>& prev = prev_;
+        size_t literal_start = 0, literal_count = 0; // literals are always a run of the input, no copy needed.
+        auto L_Flush = [&]() {
+            if (literal_count == 0)
+                return;
+            out.push_back(static_cast<uint8_t>(literal_count));
+            out.insert(out.end(), in.begin() + literal_start, in.begin() + literal_start + literal_count);
+            literal_count = 0;
+            };
+        auto Hash = [&](size_t p) {
+            uint32_t hash = (static_cast<uint32_t>(in[p]) << 16) |
+                (static_cast<uint32_t>(in[p + 1]) << 8) |
+                (static_cast<uint32_t>(in[p + 2]));
+            return static_cast<uint16_t>((hash ^ (hash >> 8)) & 0xFFFF);
+            };
+        auto Insert = [&](size_t p) {
+            if (p + MIN > size)
+                return;
+            uint16_t h = Hash(p);
+            prev[p & WINDOW] = hash_table[h];
+            hash_table[h] = base + static_cast<int64_t>(p);
+            };
+        auto Find = [&](size_t p, size_t& matched_off) -> size_t { // longest match within 'depth' candidates.
+            if (p + MIN > size)
+                return 0;
+            size_t best = 0, depth = params.depth;
+            size_t limit = std::min(MAX, size - p);
+            int64_t candidate = hash_table[Hash(p)];
+            while (candidate >= base && p - static_cast<size_t>(candidate - base) <= WINDOW && depth-- > 0) {
+                size_t c = static_cast<size_t>(candidate - base);
+                if (in[c + best] == in[p + best]) { // cant beat 'best' otherwise.
+                    size_t curr_matched_len = Kernel::MatchLength(in.data() + c, in.data() + p, limit);
+                    if (curr_matched_len > best) {
+                        best = curr_matched_len;
+                        matched_off = p - c;
+                        if (best >= params.nice || best == limit)
+                            break;
+                    }
                 }
+                candidate = prev[c & WINDOW];
             }
-            hash_table[h] = pos;
-        }
-        if (matched_len >= MIN) {
-            if (!literals.empty())
+            return best >= MIN ? best : 0;
+            };
+        auto Literal = [&](size_t p) {
+            if (literal_count == 0)
+                literal_start = p;
+            if (++literal_count == 127)
+                L_Flush();
+            };
+
+        while (pos < size) {
+            size_t matched_off = 0;
+            size_t matched_len = Find(pos, matched_off);
+            Insert(pos);
+            // lazy matching: if the next byte starts a longer match, give this one up for a literal.
+            for (size_t tries = params.lazy; matched_len != 0 && matched_len < params.nice && tries > 0 && pos + 1 < size; --tries) {
+                size_t next_off = 0;
+                size_t next_len = Find(pos + 1, next_off);
+                if (next_len <= matched_len)
+                    break;
+                Literal(pos);
+                pos++;
+                Insert(pos);
+                matched_len = next_len;
+                matched_off = next_off;
+            }
+            if (matched_len >= MIN) {
                 L_Flush();
-            uint8_t token = static_cast<uint8_t>((matched_len - MIN) + 128);
-            out.push_back(token);
-            uint16_t off = static_cast<uint16_t>(matched_off);
-            out.push_back(static_cast<uint8_t>((off >> 8) & 0xFF));
-            out.push_back(static_cast<uint8_t>(off & 0xFF));
-            pos += matched_len;
+                uint8_t token = static_cast<uint8_t>((matched_len - MIN) + 128);
+                out.push_back(token);
+                uint16_t off = static_cast<uint16_t>(matched_off);
+                out.push_back(static_cast<uint8_t>((off >> 8) & 0xFF));
+                out.push_back(static_cast<uint8_t>(off & 0xFF));
+                for (size_t i = 1; i < matched_len; ++i)
+                    Insert(pos + i);
+                pos += matched_len;
+                matches++;
+                match_bytes += matched_len;
+            }
+            else {
+                Literal(pos);
+                pos++;
+            }
+        }
+        L_Flush();
+        base_ += static_cast<int64_t>(size);
+        AddStat(stats, &PackStats::matches, matches);
+        AddStat(stats, &PackStats::match_bytes, match_bytes);
+        AddStat(stats, &PackStats::literals, size - match_bytes);
+    }
+    std::vector<int64_t> hash_table_, prev_;
+    int64_t base_ = 0;
+};
+
+inline std::vector<uint8_t> Compress(ByteView in, int level = DEFAULT_LEVEL, PackStats* stats = nullptr) { // mixed compression.
+    std::vector<uint8_t> out;
+    LzssEncoder().Encode(in, level, out, stats);
+    return out;
+}
+
+inline size_t DecompressInto(ByteView in, uint8_t* out, size_t out_size);
+
+inline std::vector<uint8_t> Decompress(ByteView in) { // decompression, but with freedom.
+    // the tokens say how big the output is, one pass over them sizes it and the decoder writes straight into it.
+    size_t pos = 0, size = in.size(), total = 0;
+    while (pos < size) {
+        uint8_t cmd = in[pos++];
+        if (cmd < 128) {
+            total += cmd;
+            pos += cmd;
         }
         else {
-            literals.push_back(in[pos]);
-            pos++;
-            if (literals.size() == 127)
-                L_Flush();
+            total += (cmd - 128) + MIN;
+            pos += 2;
         }
     }
-    if (!literals.empty())
-        L_Flush();
+    std::vector<uint8_t> out(total);
+    out.resize(DecompressInto(in, out.data(), out.size()));
     return out;
 }
 
-std::vector<uint8_t> Decompress(const std::vector<uint8_t>& in) { // decompression, but with freedom.
-    std::vector<uint8_t> out;
-    size_t pos = 0, size = in.size();
+inline size_t DecompressInto(ByteView in, uint8_t* out, size_t out_size) { // same decoder, straight into a buffer of known size. returns bytes written.
+    size_t pos = 0, size = in.size(), n = 0;
     while (pos < size) {
         uint8_t cmd = in[pos++];
         if (cmd < 128) {
             size_t count = cmd;
             if (pos + count > size)
                 throw std::runtime_error("Not enough data during decompression.");
-            out.insert(out.end(), in.begin() + pos, in.begin() + pos + count);
+            if (count > out_size - n)
+                throw std::runtime_error("Decompressed data larger than expected.");
+            memcpy(out + n, in.data() + pos, count);
+            n += count;
             pos += count;
         }
         else {
@@ -167,27 +355,36 @@ std::vector<uint8_t> Decompress(const std::vector<uint8_t>& in) { // decompressi
                 throw std::runtime_error("Not enough data for match offset.");
             uint16_t offset = (static_cast<uint16_t>(in[pos]) << 8) | in[pos + 1];
             pos += 2;
-            if (offset > out.size())
+            if (offset == 0 || offset > n)
                 throw std::runtime_error("Invalid offset during decompression.");
-            size_t ref_pos = out.size() - offset;
-            for (size_t i = 0; i < matched_length; i++)
-                out.push_back(out[ref_pos + i]);
+            if (matched_length > out_size - n)
+                throw std::runtime_error("Decompressed data larger than expected.");
+            CopyMatchWild(out + n, offset, matched_length, out_size - n);
+            n += matched_length;
         }
     }
-    return out;
+    return n;
 }
 
-std::vector<uint8_t> E_Entropy(const std::vector<uint8_t>& in) { // compress file entropy.
+inline std::vector<uint8_t> E_Entropy(ByteView in, int level = Z_BEST_COMPRESSION) { // compress file entropy.
     uLongf destination_len = compressBound(in.size());
     std::vector<uint8_t> out(destination_len);
-    int ret = compress2(out.data(), &destination_len, in.data(), in.size(), Z_BEST_COMPRESSION);
+    int ret = compress2(out.data(), &destination_len, in.data(), in.size(), std::clamp(level, 1, 9));
     if (ret != Z_OK)
         throw std::runtime_error("zlib error during compression: " + std::to_string(ret));
     out.resize(destination_len);
     return out;
 }
 
-std::vector<uint8_t> D_Entropy(const std::vector<uint8_t>& in, size_t original_size) { // decompress it.
+inline size_t D_EntropyInto(ByteView in, uint8_t* out, size_t out_size) { // straight into a buffer of known size, returns bytes written.
+    uLongf destination_len = out_size;
+    int ret = uncompress(out, &destination_len, in.data(), in.size());
+    if (ret != Z_OK)
+        throw std::runtime_error("zlib error during decompression: " + std::to_string(ret));
+    return destination_len;
+}
+
+inline std::vector<uint8_t> D_Entropy(ByteView in, size_t original_size) { // decompress it.
     std::vector<uint8_t> out(original_size);
     uLongf destination_len = original_size;
     int ret = uncompress(out.data(), &destination_len, in.data(), in.size());
@@ -197,7 +394,80 @@ std::vector<uint8_t> D_Entropy(const std::vector<uint8_t>& in, size_t original_s
     return out;
 }
 
-std::vector<uint8_t> generate_key(size_t len) { // file generation for extra layer. usual key size : 16
+// zlib streams that stay open between calls, setting one up costs a few hundred KiB. same output as compress2 and
+// uncompress, blocks only, avail_in is 32 bits.
+class Deflater {
+public:
+    Deflater() = default;
+    ~Deflater() {
+        if (ready_)
+            deflateEnd(&stream_);
+    }
+    Deflater(const Deflater&) = delete;
+    Deflater& operator=(const Deflater&) = delete;
+    void Compress(ByteView in, int level, std::vector<uint8_t>& out) { // out is overwritten.
+        level = std::clamp(level, 1, 9);
+        if (!ready_) {
+            stream_ = {};
+            if (deflateInit(&stream_, level) != Z_OK)
+                throw std::runtime_error("zlib error: deflate setup failed.");
+            ready_ = true;
+            level_ = level;
+        }
+        else {
+            deflateReset(&stream_);
+            if (level != level_ && deflateParams(&stream_, level, Z_DEFAULT_STRATEGY) == Z_OK)
+                level_ = level;
+        }
+        out.resize(deflateBound(&stream_, static_cast<uLong>(in.size())));
+        stream_.next_in = const_cast<Bytef*>(in.data());
+        stream_.avail_in = static_cast<uInt>(in.size());
+        stream_.next_out = out.data();
+        stream_.avail_out = static_cast<uInt>(out.size());
+        int ret = deflate(&stream_, Z_FINISH);
+        if (ret != Z_STREAM_END)
+            throw std::runtime_error("zlib error during compression: " + std::to_string(ret));
+        out.resize(stream_.total_out);
+    }
+private:
+    z_stream stream_{};
+    bool ready_ = false;
+    int level_ = 0;
+};
+
+class Inflater {
+public:
+    Inflater() = default;
+    ~Inflater() {
+        if (ready_)
+            inflateEnd(&stream_);
+    }
+    Inflater(const Inflater&) = delete;
+    Inflater& operator=(const Inflater&) = delete;
+    size_t DecompressInto(ByteView in, uint8_t* out, size_t out_size) { // returns bytes written.
+        if (!ready_) {
+            stream_ = {};
+            if (inflateInit(&stream_) != Z_OK)
+                throw std::runtime_error("zlib error: inflate setup failed.");
+            ready_ = true;
+        }
+        else
+            inflateReset(&stream_);
+        stream_.next_in = const_cast<Bytef*>(in.data());
+        stream_.avail_in = static_cast<uInt>(in.size());
+        stream_.next_out = out;
+        stream_.avail_out = static_cast<uInt>(out_size);
+        int ret = inflate(&stream_, Z_FINISH);
+        if (ret != Z_STREAM_END)
+            throw std::runtime_error("zlib error during decompression: " + std::to_string(ret == Z_OK ? Z_BUF_ERROR : ret));
+        return stream_.total_out;
+    }
+private:
+    z_stream stream_{};
+    bool ready_ = false;
+};
+
+inline std::vector<uint8_t> generate_key(size_t len) { // file generation for extra layer. usual key size : 16
     std::vector<uint8_t> key(len);
     std::random_device rd;
     std::mt19937 gen(rd());
@@ -207,9 +477,9 @@ std::vector<uint8_t> generate_key(size_t len) { // file generation for extra lay
     return key;
 }
 
-std::vector<uint8_t> E_CompressFile(const std::vector<uint8_t>& in, const std::vector<uint8_t>& key) {
-    auto lzss = Compress(in);
-    auto entropy = E_Entropy(lzss);
+inline std::vector<uint8_t> E_CompressFile(const std::vector<uint8_t>& in, const std::vector<uint8_t>& key, int level = DEFAULT_LEVEL) {
+    auto lzss = Compress(in, level);
+    auto entropy = E_Entropy(lzss, level);
     std::vector<uint8_t> payload;
     uint32_t s_lzss = static_cast<uint32_t>(lzss.size());
     payload.push_back(static_cast<uint8_t>(s_lzss & 0xFF));
@@ -217,22 +487,21 @@ std::vector<uint8_t> E_CompressFile(const std::vector<uint8_t>& in, const std::v
     payload.push_back(static_cast<uint8_t>((s_lzss >> 16) & 0xFF));
     payload.push_back(static_cast<uint8_t>((s_lzss >> 24) & 0xFF));
     payload.insert(payload.end(), entropy.begin(), entropy.end());
-    auto encrypted = a_xor(payload, key);
-    return encrypted;
+    a_xor_inplace(payload.data(), payload.size(), key, 0);
+    return payload;
 }
 
-std::vector<uint8_t> D_DecompressFile(const std::vector<uint8_t>& in, const std::vector<uint8_t>& key) {
+inline std::vector<uint8_t> D_DecompressFile(ByteView in, const std::vector<uint8_t>& key) {
     auto decrypted = a_xor(in, key);
     if (decrypted.size() < 4)
         throw std::runtime_error("Decrypted file data too short.");
     uint32_t S_LZSS = decrypted[0] | (decrypted[1] << 8) |
         (decrypted[2] << 16) | (decrypted[3] << 24);
-    std::vector<uint8_t> entropy(decrypted.begin() + 4, decrypted.end());
-    auto lzss = D_Entropy(entropy, S_LZSS);
+    auto lzss = D_Entropy(ByteView(decrypted).subspan(4), S_LZSS);
     return Decompress(lzss);
 }
 
-void WriteArchiveHeader(std::vector<uint8_t>& out, const std::vector<uint8_t>& key, bool archive_folder) {
+inline void WriteArchiveHeader(std::vector<uint8_t>& out, const std::vector<uint8_t>& key, bool archive_folder) {
     out.insert(out.end(), MAGIC, MAGIC + MAGIC_SIZE);
     out.push_back(static_cast<uint8_t>(key.size()));
     for (uint8_t b : key)
@@ -240,84 +509,162 @@ void WriteArchiveHeader(std::vector<uint8_t>& out, const std::vector<uint8_t>& k
     out.push_back(archive_folder ? FOLDER_FLAG : 0);
 }
 
-void Readarchiveheader(std::vector<uint8_t>& data, std::vector<uint8_t>& key, bool& archive_folder) {
-    if (data.size() < MAGIC_SIZE + 2)
+inline size_t ParseArchiveHeader(const uint8_t* data, size_t size, std::vector<uint8_t>& key, uint8_t& flags) { // returns header length.
+    if (size < MAGIC_SIZE + 2)
         throw std::runtime_error("your data is too short for archive header.");
-    if (memcmp(data.data(), MAGIC, MAGIC_SIZE) != 0)
+    if (memcmp(data, MAGIC, MAGIC_SIZE) != 0)
         throw std::runtime_error("invalid magic(val) in archive header.");
     size_t pos = MAGIC_SIZE;
     uint8_t key_len = data[pos++];
-    if (data.size() < pos + key_len + 1)
+    if (size < pos + key_len + 1)
         throw std::runtime_error("your data is too short for key in archive header.");
+    if (key_len == 0)
+        throw std::runtime_error("empty key in archive header.");
     key.clear();
     for (size_t i = 0; i < key_len; ++i)
         key.push_back(data[pos + i] ^ EKEY);
     pos += key_len;
-    archive_folder = (data[pos++] == FOLDER_FLAG);
-    data.erase(data.begin(), data.begin() + pos);
+    flags = data[pos++];
+    return pos;
 }
 
-std::vector<uint8_t> ArchiveFolderPayload(const fs::path& folder_path, const std::vector<uint8_t>& key) {
-    std::vector<uint8_t> payload;
-    std::vector<fs::path> file_list;
+inline ByteView ArchiveBody(ByteView archive, std::vector<uint8_t>& key, uint8_t& flags) { // header parsed in place, the body is a view into the archive.
+    size_t pos = ParseArchiveHeader(archive.data(), archive.size(), key, flags);
+    return archive.subspan(pos);
+}
+
+inline int64_t FileStamp(fs::file_time_type time) { // last write time as a plain number, only ever compared with itself.
+    return static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count());
+}
+
+struct FolderScan { // one walk of a folder, everything the packers need to know about its files up front.
+    std::vector<fs::path> files; // regular files, relative and sorted.
+    std::vector<uintmax_t> sizes;
+    std::vector<int64_t> mtimes; // see FileStamp.
+};
+
+// the walk itself only reads directories, the file type comes with each directory entry on most systems. size and
+// mtime take a stat per file where they dont come with it, those run on 'jobs' threads so on network storage the
+// round trips overlap instead of adding up. nothing walks the folder again after this.
+inline FolderScan ScanFolder(const fs::path& folder_path, size_t jobs) {
+    std::vector<fs::directory_entry> found;
     for (auto& entry : fs::recursive_directory_iterator(folder_path)) {
-        if (fs::is_regular_file(entry))
-            file_list.push_back(fs::relative(entry.path(), folder_path));
+        if (entry.is_regular_file())
+            found.push_back(entry);
     }
-    uint32_t archive_count = static_cast<uint32_t>(file_list.size());
-    payload.push_back(static_cast<uint8_t>(archive_count & 0xFF));
-    payload.push_back(static_cast<uint8_t>((archive_count >> 8) & 0xFF));
-    payload.push_back(static_cast<uint8_t>((archive_count >> 16) & 0xFF));
-    payload.push_back(static_cast<uint8_t>((archive_count >> 24) & 0xFF));
-    for (const auto& relative_path : file_list) {
-        std::string path_str = relative_path.generic_string();
-        uint32_t path_len = static_cast<uint32_t>(path_str.size());
-        payload.push_back(static_cast<uint8_t>(path_len & 0xFF));
-        payload.push_back(static_cast<uint8_t>((path_len >> 8) & 0xFF));
-        payload.push_back(static_cast<uint8_t>((path_len >> 16) & 0xFF));
-        payload.push_back(static_cast<uint8_t>((path_len >> 24) & 0xFF));
-        payload.insert(payload.end(), path_str.begin(), path_str.end());
-        fs::path full_path = folder_path / relative_path;
-        std::vector<uint8_t> file_data = Read(full_path.string());
-        std::vector<uint8_t> comp_data = E_CompressFile(file_data, key);
+    std::sort(found.begin(), found.end()); // stable archive, whatever the filesystem order.
+    FolderScan scan;
+    scan.files.resize(found.size());
+    scan.sizes.resize(found.size());
+    scan.mtimes.resize(found.size());
+    ParallelFor(found.size(), jobs, [&](size_t i) {
+        scan.files[i] = found[i].path().lexically_relative(folder_path);
+        scan.sizes[i] = found[i].file_size();
+        scan.mtimes[i] = FileStamp(found[i].last_write_time());
+        });
+    return scan;
+}
+
+inline std::vector<uint8_t> ArchiveFolderPayload(const fs::path& folder_path, const std::vector<uint8_t>& key, const PackOptions& options = {}) {
+    std::vector<uint8_t> payload;
+    FolderScan scan = ScanFolder(folder_path, options.jobs);
+    const std::vector<fs::path>& file_list = scan.files;
+    const std::vector<uintmax_t>& sizes = scan.sizes;
+    // biggest files go first, so a huge one never starts last and holds the whole run.
+    std::vector<size_t> order(file_list.size());
+    for (size_t i = 0; i < file_list.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+    std::vector<std::vector<uint8_t>> blocks(file_list.size());
+    ParallelFor(order.size(), options.jobs, [&](size_t n) {
+        size_t i = order[n];
+        fs::path full_path = folder_path / file_list[i];
+        std::vector<uint8_t> comp_data = E_CompressFile(Read(full_path.string()), key, options.level);
         if (comp_data.size() < 4)
             throw std::runtime_error("internal error: compressed block too short.");
-        payload.push_back(comp_data[0]);
-        payload.push_back(comp_data[1]);
-        payload.push_back(comp_data[2]);
-        payload.push_back(comp_data[3]);
-        uint32_t comp_size = static_cast<uint32_t>(comp_data.size());
-        payload.push_back(static_cast<uint8_t>(comp_size & 0xFF));
-        payload.push_back(static_cast<uint8_t>((comp_size >> 8) & 0xFF));
-        payload.push_back(static_cast<uint8_t>((comp_size >> 16) & 0xFF));
-        payload.push_back(static_cast<uint8_t>((comp_size >> 24) & 0xFF));
+        blocks[i] = std::move(comp_data);
+        });
+    uint32_t archive_count = static_cast<uint32_t>(file_list.size());
+    PutLE(payload, archive_count, 4);
+    for (size_t i = 0; i < file_list.size(); ++i) { // emitted in path order, whoever finished first.
+        std::string path_str = file_list[i].generic_string();
+        PutLE(payload, path_str.size(), 4);
+        payload.insert(payload.end(), path_str.begin(), path_str.end());
+        std::vector<uint8_t>& comp_data = blocks[i];
+        payload.insert(payload.end(), comp_data.begin(), comp_data.begin() + 4);
+        PutLE(payload, comp_data.size(), 4);
         payload.insert(payload.end(), comp_data.begin(), comp_data.end());
+        std::vector<uint8_t>().swap(comp_data);
     }
     return payload;
 }
 
-std::vector<uint8_t> BuildFolderArchive(const fs::path& folder_path, const std::vector<uint8_t>& key) {
-    std::vector<uint8_t> payload = ArchiveFolderPayload(folder_path, key);
-    std::vector<uint8_t> payload2 = a_xor(payload, key); // xor again.
+inline std::vector<uint8_t> BuildFolderArchive(const fs::path& folder_path, const std::vector<uint8_t>& key, const PackOptions& options = {}) {
+    std::vector<uint8_t> payload = ArchiveFolderPayload(folder_path, key, options);
     std::vector<uint8_t> archive;
     WriteArchiveHeader(archive, key, true);
-    archive.insert(archive.end(), payload2.begin(), payload2.end());
+    size_t body = archive.size();
+    archive.insert(archive.end(), payload.begin(), payload.end());
+    a_xor_inplace(archive.data() + body, payload.size(), key, 0); // xor again, in place this time.
     return archive;
 }
 
-void ExtractFolderArchive(const std::string& archive_file, const fs::path& out_folder) {
-    std::vector<uint8_t> archive_data = Read(archive_file);
-    std::vector<uint8_t> key;
-    bool folder_flag = false;
-    Readarchiveheader(archive_data, key, folder_flag);
-    if (!folder_flag)
-        throw std::runtime_error("archive is not a folder archive.");
-    std::vector<uint8_t> payload = a_xor(archive_data, key); // xor it, but not simple.
+// every parent folder of the entries about to be written, each created once before the workers start. sorted, so the
+// repeats sit next to each other and drop out in one pass.
+inline void CreateParentFolders(const fs::path& out_folder, std::vector<fs::path> parents, PackStats* stats = nullptr) {
+    StageTimer timer(stats, &PackStats::io_ns);
+    std::sort(parents.begin(), parents.end());
+    parents.erase(std::unique(parents.begin(), parents.end()), parents.end());
+    for (const auto& parent : parents)
+        fs::create_directories(out_folder / parent);
+}
+
+// the "Extracted:" lines. the workers add to one buffer and it goes out in batches, not a write per file. lines come
+// in the order entries finish, nothing at all with -q.
+class ExtractLog {
+public:
+    explicit ExtractLog(bool quiet) : quiet_(quiet) {}
+    ~ExtractLog() { Flush(); }
+    ExtractLog(const ExtractLog&) = delete;
+    ExtractLog& operator=(const ExtractLog&) = delete;
+    void Add(const fs::path& path) {
+        if (quiet_)
+            return;
+        std::lock_guard<std::mutex> guard(lock_);
+        lines_ += "Extracted: ";
+        lines_ += path.string();
+        lines_ += '\n';
+        if (lines_.size() >= (64 << 10))
+            FlushLocked();
+    }
+    void Flush() {
+        std::lock_guard<std::mutex> guard(lock_);
+        FlushLocked();
+    }
+private:
+    void FlushLocked() {
+        std::cout.write(lines_.data(), static_cast<std::streamsize>(lines_.size()));
+        lines_.clear();
+    }
+    bool quiet_;
+    std::mutex lock_;
+    std::string lines_;
+};
+
+struct LegacyEntry { // an entry of the old folder format.
+    std::string path;
+    size_t offset, size; // compressed data in the decrypted payload.
+};
+
+// the old format has no directory, so the entry table is parsed up front from the decrypted payload. the entries are
+// independent after that.
+inline std::vector<LegacyEntry> LegacyFolderEntries(const std::vector<uint8_t>& payload) {
     size_t pos = 0;
     if (payload.size() < 4)
         throw std::runtime_error("payload is too short in folder archive.");
     uint32_t archive_count = payload[pos] | (payload[pos + 1] << 8) | (payload[pos + 2] << 16) | (payload[pos + 3] << 24);
     pos += 4;
+    std::vector<LegacyEntry> entries;
     for (uint32_t i = 0; i < archive_count; i++) {
         if (pos + 4 > payload.size())
             throw std::runtime_error("corrupted archive: missing path length.");
@@ -336,28 +683,1609 @@ void ExtractFolderArchive(const std::string& archive_file, const fs::path& out_f
         pos += 4;
         if (pos + block_size > payload.size())
             throw std::runtime_error("corrupted archive: incomplete compressed block.");
-        std::vector<uint8_t> comp_block(payload.begin() + pos, payload.begin() + pos + block_size);
+        entries.push_back({ relative_path, pos, block_size });
         pos += block_size;
-        std::vector<uint8_t> file_data = D_DecompressFile(comp_block, key);
-        fs::path output_path = out_folder / relative_path;
-        fs::create_directories(output_path.parent_path());
-        Write(output_path.string(), file_data);
-        std::cout << "Extracted: " << output_path.string() << "\n";
     }
+    return entries;
+}
+
+inline void ExtractFolderArchive(const std::string& archive_file, const fs::path& out_folder, const PackOptions& options = {}) {
+    MappedFile archive(archive_file);
+    std::vector<uint8_t> key;
+    uint8_t flags = 0;
+    ByteView body = ArchiveBody(archive.view(), key, flags);
+    if (flags != FOLDER_FLAG)
+        throw std::runtime_error("archive is not a folder archive.");
+    std::vector<uint8_t> payload = a_xor(body, key); // xor it, but not simple. the only copy of the archive.
+    std::vector<LegacyEntry> entries = LegacyFolderEntries(payload);
+    std::vector<fs::path> parents;
+    for (const auto& entry : entries)
+        parents.push_back(fs::path(entry.path).parent_path());
+    CreateParentFolders(out_folder, std::move(parents), options.stats);
+    ExtractLog log(options.quiet);
+    ParallelFor(entries.size(), options.jobs, [&](size_t i) {
+        const LegacyEntry& entry = entries[i];
+        std::vector<uint8_t> file_data = D_DecompressFile(ByteView(payload).subspan(entry.offset, entry.size), key);
+        fs::path output_path = out_folder / entry.path;
+        Write(output_path.string(), file_data);
+        log.Add(output_path);
+        });
 }
-std::vector<uint8_t> BuildFileArchive(const std::vector<uint8_t>& file_data, const std::vector<uint8_t>& key) {
+inline std::vector<uint8_t> BuildFileArchive(const std::vector<uint8_t>& file_data, const std::vector<uint8_t>& key) {
     std::vector<uint8_t> comp = E_CompressFile(file_data, key);
     std::vector<uint8_t> archive;
     WriteArchiveHeader(archive, key, false);
     archive.insert(archive.end(), comp.begin(), comp.end());
     return archive;
 }
-std::vector<uint8_t> ExtractFileArchive(const std::string& archive, const std::vector<uint8_t>& /*optkey*/) {
-    std::vector<uint8_t> archive_data = Read(archive);
+inline std::vector<uint8_t> ExtractFileArchive(const std::string& archive, const std::vector<uint8_t>& /*optkey*/) {
+    MappedFile archive_data(archive);
     std::vector<uint8_t> file_key;
-    bool folder_flag = false;
-    Readarchiveheader(archive_data, file_key, folder_flag);
-    if (folder_flag)
+    uint8_t flags = 0;
+    ByteView body = ArchiveBody(archive_data.view(), file_key, flags);
+    if (flags == FOLDER_FLAG)
+        throw std::runtime_error("archive is a folder archive, not a file archive, try '-folder' instead.");
+    return D_DecompressFile(body, file_key);
+}
+
+// streamed file archive: [block size:8] then blocks of [raw:8][mode:1 | lzss:7][zlib:8][data][crc32c:4], then the
+// block table, [offset:8][raw:8] per block, and [block count:8][total raw size:8]. the crc is there when the mode has
+// BLOCK_CHECKSUM. everything after the header is xored as one stream, so any block can be decrypted and decoded on
+// its own by knowing where it sits.
+struct StreamBlock {
+    size_t index = 0; // place in the file.
+    std::vector<uint8_t> data; // raw bytes going in, the record coming out.
+    uint64_t raw_size = 0;
+};
+
+struct RecordRef { // a block record inside a mapped body, and where its raw data goes in the output.
+    uint64_t offset = 0;
+    uint64_t size = 0; // header included.
+    uint64_t raw_offset = 0;
+    uint64_t raw_size = 0;
+};
+
+inline uint64_t RecordsRawSize(const std::vector<RecordRef>& records) {
+    return records.empty() ? 0 : records.back().raw_offset + records.back().raw_size;
+}
+
+inline void WriteXored(std::ofstream& f, std::vector<uint8_t>& data, const std::vector<uint8_t>& key, uint64_t& offset, PackStats* stats = nullptr) {
+    {
+        StageTimer timer(stats, &PackStats::xor_ns);
+        a_xor_inplace(data.data(), data.size(), key, offset);
+    }
+    StageTimer timer(stats, &PackStats::io_ns);
+    f.write(reinterpret_cast<const char*>(data.data()), data.size());
+    if (!f)
+        throw std::runtime_error("error writing archive data.");
+    offset += data.size();
+    AddStat(stats, &PackStats::archive_bytes, data.size());
+}
+
+inline void ReadXored(ByteView body, uint64_t offset, uint8_t* data, size_t len, const std::vector<uint8_t>& key, PackStats* stats = nullptr) { // decrypts while copying out of the body.
+    if (offset > body.size() || len > body.size() - offset)
+        throw std::runtime_error("corrupted archive: unexpected end of stream.");
+    StageTimer timer(stats, &PackStats::xor_ns); // page faults on the mapping land here too.
+    a_xor_copy(body.data() + offset, data, len, key, offset);
+    AddStat(stats, &PackStats::archive_bytes, len);
+}
+
+inline double SampleEntropy(ByteView in) { // shannon entropy in bits per byte, over 16 windows of 4 KiB spread across the input.
+    const size_t window = 4096, windows = 16;
+    uint32_t histogram[256] = {};
+    size_t count = 0;
+    auto Add = [&](size_t start, size_t len) {
+        for (size_t i = start; i < start + len; ++i)
+            histogram[in[i]]++;
+        count += len;
+        };
+    if (in.size() <= window * windows)
+        Add(0, in.size());
+    else {
+        for (size_t w = 0; w < windows; ++w)
+            Add((in.size() - window) * w / (windows - 1), window);
+    }
+    double entropy = 0;
+    for (uint32_t c : histogram) {
+        if (c) {
+            double p = static_cast<double>(c) / count;
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy;
+}
+
+// the block codec as objects. match finder tables, zlib streams and scratch buffers live as long as they do, so a
+// caller going block after block allocates nothing once the buffers have grown to size. one per thread, they are not
+// shared. E_CompressBlock and D_DecompressBlock keep one per worker thread.
+class BlockCompressor {
+public:
+    static size_t Bound(size_t raw_size) { // largest record any mode can produce, what the span overload needs.
+        size_t tokens = raw_size + raw_size / 127 + 1;
+        return BLOCK_HEADER_SIZE + std::max<size_t>(HUFF_HEADER_SIZE + 2 * tokens + 8, compressBound(static_cast<uLong>(tokens))) +
+            BLOCK_CHECKSUM_SIZE + BLOCK_HEADER_SIZE + 16; // a long record wraps an inner one.
+    }
+    ByteView Compress(ByteView in, const PackOptions& options = {}) { // one self-contained record, not yet xored. valid until the next call.
+        if (options.window && options.mode != BLOCK_STORED) {
+            {
+                StageTimer timer(options.stats, &PackStats::lzss_ns);
+                long_.Find(in, static_cast<size_t>(std::min<uint64_t>(options.window, LONG_WINDOW_MAX)), long_matches_);
+            }
+            if (!long_matches_.empty())
+                return CompressLong(in, options);
+        }
+        return Encode(in, options, false);
+    }
+    size_t Compress(ByteView in, std::span<uint8_t> out, const PackOptions& options = {}) { // into the caller's buffer, Bound() always fits.
+        ByteView record = Compress(in, options);
+        if (record.size() > out.size())
+            throw std::runtime_error("output buffer too small for the block record.");
+        memcpy(out.data(), record.data(), record.size());
+        return record.size();
+    }
+private:
+    // the long matches as [count] then [literals before it][offset][length] per match, all varints, then the bytes
+    // between the matches as an inner record. the record's lzss size is the size of those bytes.
+    ByteView CompressLong(ByteView in, const PackOptions& options) {
+        long_table_.clear();
+        residual_.clear();
+        PutVarint(long_table_, long_matches_.size());
+        size_t pos = 0;
+        uint64_t matched = 0;
+        for (const LongMatch& match : long_matches_) {
+            PutVarint(long_table_, match.pos - pos);
+            PutVarint(long_table_, match.offset);
+            PutVarint(long_table_, match.length);
+            residual_.insert(residual_.end(), in.begin() + pos, in.begin() + match.pos);
+            pos = match.pos + match.length;
+            matched += match.length;
+        }
+        residual_.insert(residual_.end(), in.begin() + pos, in.end());
+        ByteView inner = Encode(residual_, options, true);
+        long_record_.clear();
+        long_record_.reserve(BLOCK_HEADER_SIZE + long_table_.size() + inner.size() + BLOCK_CHECKSUM_SIZE);
+        PutLE(long_record_, in.size(), 8);
+        PutLE(long_record_, residual_.size() | (static_cast<uint64_t>(BLOCK_LONG | BLOCK_CHECKSUM) << 56), 8);
+        PutLE(long_record_, long_table_.size() + inner.size() + BLOCK_CHECKSUM_SIZE, 8);
+        long_record_.insert(long_record_.end(), long_table_.begin(), long_table_.end());
+        long_record_.insert(long_record_.end(), inner.begin(), inner.end());
+        PutLE(long_record_, Crc32c(in.data(), in.size()), BLOCK_CHECKSUM_SIZE);
+        PackStats* stats = options.stats;
+        AddStat(stats, &PackStats::matches, long_matches_.size());
+        AddStat(stats, &PackStats::match_bytes, matched);
+        AddStat(stats, &PackStats::raw_bytes, in.size());
+        AddStat(stats, &PackStats::lzss_bytes, residual_.size());
+        AddStat(stats, &PackStats::entropy_bytes, long_record_.size() - BLOCK_HEADER_SIZE - BLOCK_CHECKSUM_SIZE);
+        AddStat(stats, &PackStats::done, in.size());
+        if (stats)
+            stats->mode_blocks[BLOCK_LONG]++;
+        return long_record_;
+    }
+    // one record of the plain modes. a nested one is the inside of a long record, the caller counts the block.
+    ByteView Encode(ByteView in, const PackOptions& options, bool nested) {
+        PackStats* stats = options.stats;
+        bool probe = options.mode == MODE_AUTO;
+        BlockMode mode = probe ? BLOCK_HUFF : static_cast<BlockMode>(options.mode);
+        if (probe && SampleEntropy(in) >= STORE_ENTROPY)
+            mode = BLOCK_STORED; // zips, media and the like, both passes would be wasted.
+        bool tokens = mode == BLOCK_HUFF || mode == BLOCK_BOTH || mode == BLOCK_LZSS;
+        std::vector<uint8_t>& lzss = lzss_out_;
+        std::vector<uint8_t>& entropy = entropy_;
+        if (tokens) {
+            StageTimer timer(stats, &PackStats::lzss_ns);
+            lzss_.Encode(in, options.level, lzss, stats);
+        }
+        if (mode == BLOCK_HUFF) {
+            StageTimer timer(stats, &PackStats::entropy_ns);
+            HuffEncodeTokens(lzss, entropy);
+            // repeating token patterns, numbered log lines and the like, are where a second match search still pays off.
+            bool retry = probe && options.level >= ZLIB_RETRY_LEVEL;
+            if (probe && !retry && !lzss.empty()) {
+                ByteView slice = ByteView(lzss).subspan(0, std::min(ZLIB_PROBE_SIZE, lzss.size()));
+                deflate_.Compress(slice, 1, zlib_);
+                double zlib_ratio = static_cast<double>(zlib_.size()) / slice.size();
+                double huff_ratio = static_cast<double>(entropy.size()) / lzss.size();
+                retry = zlib_ratio < 0.8 * huff_ratio;
+            }
+            if (retry) {
+                deflate_.Compress(lzss, options.level, zlib_);
+                if (zlib_.size() < entropy.size()) {
+                    entropy.swap(zlib_);
+                    mode = BLOCK_BOTH;
+                }
+            }
+        }
+        else if (mode == BLOCK_BOTH || mode == BLOCK_ZLIB) {
+            StageTimer timer(stats, &PackStats::entropy_ns);
+            deflate_.Compress(mode == BLOCK_BOTH ? ByteView(lzss) : in, options.level, entropy);
+        }
+        // what the block shrank to after each stage, a stage that was skipped passes its input on.
+        ByteView after_lzss = tokens ? ByteView(lzss) : in;
+        ByteView payload = (mode == BLOCK_LZSS || mode == BLOCK_STORED) ? after_lzss : ByteView(entropy);
+        if (probe && payload.size() >= in.size()) { // the probe missed, it still never grows.
+            mode = BLOCK_STORED;
+            after_lzss = payload = in;
+        }
+        if (!nested) {
+            AddStat(stats, &PackStats::raw_bytes, in.size());
+            AddStat(stats, &PackStats::lzss_bytes, after_lzss.size());
+            AddStat(stats, &PackStats::entropy_bytes, payload.size());
+            AddStat(stats, &PackStats::done, in.size());
+            if (stats)
+                stats->mode_blocks[mode]++;
+        }
+        record_.clear();
+        record_.reserve(BLOCK_HEADER_SIZE + payload.size() + BLOCK_CHECKSUM_SIZE);
+        PutLE(record_, in.size(), 8);
+        PutLE(record_, after_lzss.size() | (static_cast<uint64_t>(mode | BLOCK_CHECKSUM) << 56), 8);
+        PutLE(record_, payload.size() + BLOCK_CHECKSUM_SIZE, 8);
+        record_.insert(record_.end(), payload.begin(), payload.end());
+        PutLE(record_, Crc32c(in.data(), in.size()), BLOCK_CHECKSUM_SIZE);
+        return record_;
+    }
+    LzssEncoder lzss_;
+    Deflater deflate_;
+    LongMatcher long_;
+    std::vector<LongMatch> long_matches_;
+    std::vector<uint8_t> lzss_out_, entropy_, zlib_, record_, long_table_, residual_, long_record_;
+};
+
+class BlockDecompressor {
+public:
+    static uint64_t RawSize(ByteView record) { // what the record decodes to, to size the output.
+        if (record.size() < BLOCK_HEADER_SIZE)
+            throw std::runtime_error("corrupted archive: block header too short.");
+        return GetLE(record.data(), 8);
+    }
+    void Decompress(ByteView record, uint64_t block_size, uint8_t* out, uint64_t out_size, PackStats* stats = nullptr) { // record already decrypted, raw data goes to 'out'.
+        Decode(record, block_size, out, out_size, stats, false);
+    }
+    size_t Decompress(ByteView record, std::span<uint8_t> out, PackStats* stats = nullptr) { // returns bytes written.
+        uint64_t raw_size = RawSize(record);
+        if (raw_size > out.size())
+            throw std::runtime_error("output buffer too small for the block.");
+        Decompress(record, raw_size, out.data(), raw_size, stats);
+        return static_cast<size_t>(raw_size);
+    }
+private:
+    // the inside of a long record is nested, it isnt counted and cant be a long record itself.
+    void Decode(ByteView record, uint64_t block_size, uint8_t* out, uint64_t out_size, PackStats* stats, bool nested) {
+        if (record.size() < BLOCK_HEADER_SIZE)
+            throw std::runtime_error("corrupted archive: block header too short.");
+        uint64_t raw_size = GetLE(record.data(), 8);
+        uint64_t lzss_field = GetLE(record.data() + 8, 8);
+        uint64_t comp_size = GetLE(record.data() + 16, 8);
+        uint64_t lzss_size = lzss_field & ((1ull << 56) - 1);
+        uint8_t mode = static_cast<uint8_t>(lzss_field >> 56);
+        bool checked = mode & BLOCK_CHECKSUM; // records from before checksums only have the size checks.
+        mode &= ~BLOCK_CHECKSUM;
+        if (raw_size > block_size || lzss_size > 2 * raw_size + 1 || comp_size != record.size() - BLOCK_HEADER_SIZE ||
+            (checked && comp_size < BLOCK_CHECKSUM_SIZE))
+            throw std::runtime_error("corrupted archive: invalid block header.");
+        if (raw_size != out_size)
+            throw std::runtime_error("corrupted archive: block table mismatch.");
+        if (checked)
+            comp_size -= BLOCK_CHECKSUM_SIZE;
+        ByteView payload = record.subspan(BLOCK_HEADER_SIZE, static_cast<size_t>(comp_size));
+        size_t raw = static_cast<size_t>(raw_size), written = 0;
+        switch (mode) {
+        case BLOCK_BOTH: {
+            size_t lzss_written = 0;
+            lzss_.resize(static_cast<size_t>(lzss_size));
+            {
+                StageTimer timer(stats, &PackStats::entropy_ns);
+                lzss_written = inflate_.DecompressInto(payload, lzss_.data(), lzss_.size());
+            }
+            StageTimer timer(stats, &PackStats::lzss_ns);
+            written = DecompressInto(ByteView(lzss_).first(lzss_written), out, raw);
+            break;
+        }
+        case BLOCK_STORED:
+            if (comp_size != raw_size)
+                throw std::runtime_error("corrupted archive: invalid block header.");
+            memcpy(out, payload.data(), raw);
+            written = raw;
+            break;
+        case BLOCK_ZLIB: {
+            StageTimer timer(stats, &PackStats::entropy_ns);
+            written = inflate_.DecompressInto(payload, out, raw);
+            break;
+        }
+        case BLOCK_LZSS: {
+            StageTimer timer(stats, &PackStats::lzss_ns);
+            written = DecompressInto(payload, out, raw);
+            break;
+        }
+        case BLOCK_HUFF: { // tokens are decoded and applied in the same loop, it all counts as entropy time.
+            StageTimer timer(stats, &PackStats::entropy_ns);
+            written = huff_.DecodeInto(payload, out, raw);
+            break;
+        }
+        case BLOCK_LONG: {
+            if (nested)
+                throw std::runtime_error("corrupted archive: nested long record.");
+            size_t pos = 0;
+            uint64_t count = GetVarint(payload, pos);
+            if (count > payload.size() / 3)
+                throw std::runtime_error("corrupted archive: invalid long match count.");
+            long_matches_.resize(static_cast<size_t>(count));
+            for (LongMatch& match : long_matches_) { // 'pos' holds the literals in front for now.
+                match.pos = static_cast<size_t>(GetVarint(payload, pos));
+                match.offset = static_cast<size_t>(GetVarint(payload, pos));
+                match.length = static_cast<size_t>(GetVarint(payload, pos));
+            }
+            if (lzss_size > raw_size)
+                throw std::runtime_error("corrupted archive: invalid block header.");
+            if (!inner_)
+                inner_ = std::make_unique<BlockDecompressor>();
+            residual_.resize(static_cast<size_t>(lzss_size));
+            inner_->Decode(payload.subspan(pos), lzss_size, residual_.data(), lzss_size, stats, true);
+            StageTimer timer(stats, &PackStats::lzss_ns);
+            size_t used = 0; // of the residual.
+            for (const LongMatch& match : long_matches_) {
+                if (match.pos > residual_.size() - used || match.pos > raw - written)
+                    throw std::runtime_error("corrupted archive: invalid long match.");
+                memcpy(out + written, residual_.data() + used, match.pos);
+                written += match.pos;
+                used += match.pos;
+                if (match.offset == 0 || match.offset > written || match.length > raw - written)
+                    throw std::runtime_error("corrupted archive: invalid long match.");
+                CopyMatch(out + written, match.offset, match.length);
+                written += match.length;
+            }
+            if (residual_.size() - used != raw - written)
+                throw std::runtime_error("corrupted archive: block size mismatch.");
+            memcpy(out + written, residual_.data() + used, residual_.size() - used);
+            written = raw;
+            break;
+        }
+        default:
+            throw std::runtime_error("corrupted archive: unknown block mode " + std::to_string(mode) + ".");
+        }
+        if (written != raw_size)
+            throw std::runtime_error("corrupted archive: block size mismatch.");
+        if (checked && Crc32c(out, raw) != GetLE(record.data() + BLOCK_HEADER_SIZE + comp_size, BLOCK_CHECKSUM_SIZE))
+            throw std::runtime_error("corrupted archive: block checksum mismatch.");
+        if (nested)
+            return;
+        AddStat(stats, &PackStats::entropy_bytes, comp_size);
+        AddStat(stats, &PackStats::lzss_bytes, lzss_size);
+        AddStat(stats, &PackStats::raw_bytes, raw_size);
+        AddStat(stats, &PackStats::done, raw_size);
+        if (stats)
+            stats->mode_blocks[mode]++;
+    }
+    Inflater inflate_;
+    HuffDecoder huff_;
+    std::vector<uint8_t> lzss_, residual_;
+    std::vector<LongMatch> long_matches_;
+    std::unique_ptr<BlockDecompressor> inner_; // made on the first long record.
+};
+
+inline std::vector<uint8_t> E_CompressBlock(ByteView in, const PackOptions& options = {}) { // one self-contained record, not yet xored.
+    thread_local BlockCompressor compressor;
+    ByteView record = compressor.Compress(in, options);
+    return std::vector<uint8_t>(record.begin(), record.end());
+}
+
+inline void D_DecompressBlock(ByteView record, uint64_t block_size, uint8_t* out, uint64_t out_size, PackStats* stats = nullptr) { // record already decrypted, raw data goes to 'out'.
+    thread_local BlockDecompressor decompressor;
+    decompressor.Decompress(record, block_size, out, out_size, stats);
+}
+
+// decodes every record straight into its place in 'out'. the record is decrypted into a buffer of its own, that is
+// the only copy the xor leaves us. returns the crc32 of the output when asked for it.
+inline uLong DecodeRecordsInto(ByteView body, const std::vector<uint8_t>& key, const std::vector<RecordRef>& records,
+    uint64_t block_size, uint8_t* out, const PackOptions& options, bool checksum = false) {
+    std::vector<uLong> crcs(records.size());
+    ParallelFor(records.size(), options.jobs, [&](size_t i) {
+        const RecordRef& ref = records[i];
+        thread_local std::vector<uint8_t> record;
+        record.resize(static_cast<size_t>(ref.size));
+        ReadXored(body, ref.offset, record.data(), record.size(), key, options.stats);
+        uint8_t* dst = out + ref.raw_offset;
+        D_DecompressBlock(record, block_size, dst, ref.raw_size, options.stats);
+        if (checksum)
+            crcs[i] = crc32(0L, dst, static_cast<uInt>(ref.raw_size));
+        });
+    uLong crc = crc32(0L, Z_NULL, 0);
+    if (checksum) {
+        for (size_t i = 0; i < records.size(); ++i)
+            crc = crc32_combine(crc, crcs[i], static_cast<z_off_t>(records[i].raw_size));
+    }
+    return crc;
+}
+
+inline void BuildFileArchiveStream(const std::string& input_file, const std::string& archive_file, const std::vector<uint8_t>& key, const PackOptions& options = {}) {
+    std::ifstream in(input_file, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Error opening file: " + input_file);
+    std::ofstream out(archive_file, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Error opening file: " + archive_file);
+    uint64_t input_size = fs::file_size(input_file);
+    AddStat(options.stats, &PackStats::total, input_size);
+    // with -window a block is the window, long matches reach across all of it. never more than the file needs.
+    uint64_t block_size = std::max<uint64_t>(BLOCK_SIZE, std::min({ options.window, LONG_WINDOW_MAX, input_size }));
+    std::vector<uint8_t> header;
+    WriteArchiveHeader(header, key, false);
+    header.back() = STREAM_FLAG;
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    uint64_t offset = 0, total = 0, block_count = 0;
+    std::vector<uint8_t> record, table;
+    PutLE(record, block_size, 8);
+    WriteXored(out, record, key, offset, options.stats);
+    // one reader, the workers compress, each record goes out as soon as the ones before it did. a block is admitted
+    // before it is read, so 'window' blocks are all there is between the file and the archive: two per worker, fewer
+    // with big windows, and a block that is slow to compress holds the reader back instead of piling up the rest.
+    size_t window = static_cast<size_t>(std::max<uint64_t>(2, std::min<uint64_t>(2 * options.jobs, LONG_BATCH_BYTES / block_size)));
+    size_t workers = std::min(options.jobs, window);
+    auto write = [&](StreamBlock& block) {
+        PutLE(table, offset, 8);
+        PutLE(table, block.raw_size, 8);
+        WriteXored(out, block.data, key, offset, options.stats);
+        total += block.raw_size;
+        block_count++;
+        };
+    OrderedWriter<StreamBlock, decltype(write)> writer(1, window, write);
+    Pipeline<StreamBlock>(1, 1, workers, window,
+        [&](size_t, BoundedQueue<StreamBlock>& queue) {
+            try {
+                size_t count = 0;
+                while (in) {
+                    if (!writer.Admit(0))
+                        return; // the run failed elsewhere.
+                    StreamBlock block;
+                    block.index = count;
+                    block.data.resize(static_cast<size_t>(block_size));
+                    {
+                        StageTimer timer(options.stats, &PackStats::io_ns);
+                        in.read(reinterpret_cast<char*>(block.data.data()), block.data.size());
+                    }
+                    if (in.bad())
+                        throw std::runtime_error("Error reading file: " + input_file);
+                    block.data.resize(static_cast<size_t>(in.gcount()));
+                    if (block.data.empty())
+                        break;
+                    block.raw_size = block.data.size();
+                    if (!queue.Push(std::move(block)))
+                        return;
+                    count++;
+                }
+                writer.Finish(0, count);
+            }
+            catch (...) {
+                writer.Close();
+                throw;
+            }
+        },
+        [&](StreamBlock& block) {
+            try {
+                block.data = E_CompressBlock(block.data, options);
+                writer.Put(0, block.index, std::move(block));
+            }
+            catch (...) {
+                writer.Close();
+                throw;
+            }
+        });
+    PutLE(table, block_count, 8);
+    PutLE(table, total, 8);
+    WriteXored(out, table, key, offset, options.stats);
+}
+
+// the records of a streamed file archive, from the block table at its end. raw offsets are checked to add up.
+inline std::vector<RecordRef> StreamRecords(ByteView body, const std::vector<uint8_t>& key, uint64_t& block_size) {
+    uint64_t body_size = body.size();
+    if (body_size < 8 + 16)
+        throw std::runtime_error("corrupted archive: stream too short.");
+    // the table at the end tells where every block lives.
+    uint8_t head[16];
+    ReadXored(body, body_size - 16, head, 16, key);
+    uint64_t block_count = GetLE(head, 8), total = GetLE(head + 8, 8);
+    if (block_count > (body_size - 8 - 16) / (16 + BLOCK_HEADER_SIZE))
+        throw std::runtime_error("corrupted archive: invalid block count.");
+    std::vector<uint8_t> table(block_count * 16);
+    uint64_t table_start = body_size - 16 - table.size();
+    ReadXored(body, table_start, table.data(), table.size(), key);
+    ReadXored(body, 0, head, 8, key);
+    block_size = GetLE(head, 8);
+    if (block_size == 0)
+        throw std::runtime_error("corrupted archive: invalid block size.");
+    std::vector<RecordRef> records(static_cast<size_t>(block_count));
+    uint64_t raw_offset = 0;
+    for (uint64_t n = 0; n < block_count; ++n) {
+        uint64_t start = GetLE(&table[n * 16], 8);
+        uint64_t end = (n + 1 < block_count) ? GetLE(&table[(n + 1) * 16], 8) : table_start;
+        if (start < 8 || end < start + BLOCK_HEADER_SIZE || end > table_start)
+            throw std::runtime_error("corrupted archive: invalid block table.");
+        RecordRef& ref = records[n];
+        ref.offset = start;
+        ref.size = end - start;
+        ref.raw_offset = raw_offset;
+        ref.raw_size = GetLE(&table[n * 16 + 8], 8);
+        if (ref.raw_size > block_size)
+            throw std::runtime_error("corrupted archive: invalid block table.");
+        raw_offset += ref.raw_size;
+    }
+    if (raw_offset != total)
+        throw std::runtime_error("corrupted archive: total size mismatch.");
+    return records;
+}
+
+inline void ExtractFileArchiveStream(ByteView body, const std::string& output_file, const std::vector<uint8_t>& key, const PackOptions& options = {}) {
+    uint64_t block_size = 0;
+    std::vector<RecordRef> records = StreamRecords(body, key, block_size);
+    uint64_t total = RecordsRawSize(records);
+    // every block knows where it lands, so the output is sized once and the workers decode right into it.
+    AddStat(options.stats, &PackStats::total, total);
+    MappedFile out;
+    {
+        StageTimer timer(options.stats, &PackStats::io_ns);
+        out = MappedFile::Create(output_file, total);
+    }
+    DecodeRecordsInto(body, key, records, block_size, out.data(), options);
+    StageTimer timer(options.stats, &PackStats::io_ns);
+    out.Close();
+}
+
+inline void ExtractFile(const std::string& archive_file, const std::string& output_file, const PackOptions& options = {}) { // picks streamed or whole-file decoding.
+    MappedFile archive(archive_file);
+    std::vector<uint8_t> key;
+    uint8_t flags = 0;
+    ByteView body = ArchiveBody(archive.view(), key, flags);
+    if (flags == STREAM_FLAG) {
+        ExtractFileArchiveStream(body, output_file, key, options);
+        return;
+    }
+    if (flags == FOLDER_FLAG)
         throw std::runtime_error("archive is a folder archive, not a file archive, try '-folder' instead.");
-    return D_DecompressFile(archive_data, file_key);
+    Write(output_file, D_DecompressFile(body, key));
+}
+
+inline uint8_t ArchiveFlags(const std::string& archive_file) { // header sniff, nothing past the header is touched.
+    MappedFile archive(archive_file);
+    std::vector<uint8_t> key;
+    uint8_t flags = 0;
+    ArchiveBody(archive.view(), key, flags);
+    return flags;
+}
+
+// indexed folder archive: block records (same as the streamed file archive) back to back in the body, then the
+// directory, [version:1][block size:8][entry count:8] and per entry [path len:4][path][raw size:8][crc32:4][mtime:8]
+// [skip:8][extent count:4] followed by [offset:8][stored size:8] per extent, then [directory offset:8][directory size:8]
+// ["ACDX"]. an extent is a run of records, entries whose data repeats point at the same records. an entry is the
+// raw_size bytes after the first 'skip' of its decoded records, more than one entry sit in a solid group's record.
+// version 3 had no skip, versions 1 and 2 had a single extent, [path len:4][path][offset:8][stored size:8][raw size:8]
+// [crc32:4] and 2 added [mtime:8].
+// the body is xored as one stream, so a single entry can be read and decrypted without touching the rest.
+struct Extent {
+    uint64_t offset = 0; // relative to the body.
+    uint64_t stored_size = 0;
+};
+
+struct FolderEntry {
+    std::string path; // generic, relative.
+    std::vector<Extent> extents; // the entry's records in order, none for an empty file.
+    uint64_t raw_size = 0;
+    uint32_t crc = 0; // zlib crc32 of the raw data.
+    int64_t mtime = 0; // see FileStamp, 0 when the archive predates it.
+    uint64_t skip = 0; // raw bytes of the records in front of this entry, solid groups only.
+    uint64_t StoredSize() const { // shared records included.
+        uint64_t size = 0;
+        for (const auto& extent : extents)
+            size += extent.stored_size;
+        return size;
+    }
+};
+
+struct FolderIndex {
+    uint64_t block_size = BLOCK_SIZE;
+    uint64_t data_size = 0; // all records in the body, a shared one counts once.
+    std::vector<FolderEntry> entries;
+};
+
+inline void AddExtent(std::vector<Extent>& extents, uint64_t offset, uint64_t size) { // grows the last extent when it can.
+    if (!extents.empty() && extents.back().offset + extents.back().stored_size == offset)
+        extents.back().stored_size += size;
+    else
+        extents.push_back({ offset, size });
+}
+
+inline bool GlobMatch(const char* pattern, const char* text) { // '*' stays inside a path component, '**' crosses them, '?' is one char.
+    if (*pattern == '\0')
+        return *text == '\0';
+    if (pattern[0] == '*' && pattern[1] == '*') {
+        for (const char* t = text;; ++t) {
+            if (GlobMatch(pattern + 2, t))
+                return true;
+            if (*t == '\0')
+                return false;
+        }
+    }
+    if (*pattern == '*') {
+        for (const char* t = text;; ++t) {
+            if (GlobMatch(pattern + 1, t))
+                return true;
+            if (*t == '\0' || *t == '/')
+                return false;
+        }
+    }
+    if (*text == '\0' || (*text == '/' && *pattern != '/'))
+        return false;
+    if (*pattern != '?' && *pattern != *text)
+        return false;
+    return GlobMatch(pattern + 1, text + 1);
+}
+
+inline bool SafeEntryPath(const std::string& path) { // no absolute paths, no climbing out of the output folder.
+    fs::path p(path);
+    if (path.empty() || p.is_absolute() || p.has_root_name() || p.has_root_directory())
+        return false;
+    for (const auto& part : p) {
+        if (part == "..")
+            return false;
+    }
+    return true;
+}
+
+struct ChunkKey {
+    uint64_t hash = 0; // Hash64 of the raw chunk.
+    uint64_t size = 0;
+    bool operator==(const ChunkKey& other) const { return hash == other.hash && size == other.size; }
+};
+
+struct ChunkKeyHash {
+    size_t operator()(const ChunkKey& key) const { return static_cast<size_t>(key.hash ^ key.size); }
+};
+
+struct ChunkSource { // where the first copy of a chunk was read from, also its place in the body order.
+    size_t file = 0; // in the scan.
+    uint64_t offset = 0;
+};
+
+struct SolidMember { // the first copy of a solid file.
+    size_t id = 0; // its group.
+    uint64_t skip = 0;
+    size_t file = 0;
+};
+
+// every distinct chunk of one pack, compressed once. the workers share it, a chunk seen again only gets the id of the
+// first one. the hash and the size only find the candidate, the first copy is read back from its file and compared
+// before a chunk is taken for it. one that differs is a chunk of its own, outside the table. first is in entry order,
+// not in the order the readers got there, so the archive comes out the same for any number of threads: a copy read
+// ahead of an earlier one gives its place up to it and is not written, and solid groups add their members in turn.
+struct ChunkStore {
+    std::mutex lock;
+    std::unordered_map<ChunkKey, size_t, ChunkKeyHash> ids;
+    std::deque<Extent> placed; // by id, where the record went once it is written. a deque, ids are added meanwhile.
+    std::deque<ChunkSource> sources; // by id.
+    std::unordered_map<size_t, size_t> earlier; // a chunk that gave its place up -> the one written instead.
+    std::unordered_map<ChunkKey, SolidMember, ChunkKeyHash> members; // solid file -> where it sits in its group.
+    std::condition_variable turns;
+    size_t turn = 0; // of the next solid group to add its members.
+    bool failed = false;
+    size_t NewId(ChunkSource source = {}) { // called with the lock held.
+        placed.emplace_back();
+        sources.push_back(source);
+        return placed.size() - 1;
+    }
+    size_t Written(size_t id) const { // called with the lock held, or once everything is written.
+        for (auto found = earlier.find(id); found != earlier.end(); found = earlier.find(id))
+            id = found->second;
+        return id;
+    }
+    bool WaitTurn(size_t group) { // false once the run failed.
+        std::unique_lock<std::mutex> guard(lock);
+        turns.wait(guard, [&]() { return failed || turn == group; });
+        return !failed;
+    }
+    void EndTurn() {
+        std::lock_guard<std::mutex> guard(lock);
+        turn++;
+        turns.notify_all();
+    }
+    void Fail() { // lets the groups waiting for their turn go.
+        std::lock_guard<std::mutex> guard(lock);
+        failed = true;
+        turns.notify_all();
+    }
+};
+
+// whether the 'size' bytes at 'offset' in the file are 'data'. a file that cant be read or got shorter is not.
+inline bool FileHolds(const fs::path& path, uint64_t offset, const uint8_t* data, size_t size, PackStats* stats = nullptr) {
+    std::vector<uint8_t> disk(size);
+    {
+        StageTimer timer(stats, &PackStats::io_ns);
+        std::ifstream in(path, std::ios::binary);
+        if (!in.seekg(static_cast<std::streamoff>(offset)))
+            return false;
+        in.read(reinterpret_cast<char*>(disk.data()), static_cast<std::streamsize>(size));
+        if (static_cast<size_t>(in.gcount()) != size)
+            return false;
+    }
+    return std::memcmp(disk.data(), data, size) == 0;
+}
+
+struct PackJob { // a chunk or solid group read ahead, waiting for a worker to compress it, then for its turn to be written.
+    size_t task = 0, index = 0; // what read it and its place there, the order of the body.
+    size_t id = 0; // in the store.
+    std::vector<uint8_t> data; // raw, then the record.
+};
+
+// one file into chunks, each a block record. fixed BLOCK_SIZE chunks, or content-defined ones with options.chunks so
+// an insertion doesnt shift every chunk after it. chunks the store already has are not compressed again, new ones go
+// to emit(id, data) for the workers, which is false once the run failed. size and crc of the entry are filled in on the
+// way, 'chunks' gets the ids in file order.
+template <typename Emit>
+void ReadFolderEntry(const fs::path& folder_path, const std::vector<fs::path>& file_list, size_t file, FolderEntry& entry,
+    std::vector<size_t>& chunks, ChunkStore& store, Emit&& emit, const PackOptions& options) {
+    fs::path full_path = folder_path / file_list[file];
+    std::ifstream in(full_path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Error opening file: " + full_path.string());
+    entry.raw_size = 0;
+    entry.crc = crc32(0L, Z_NULL, 0);
+    chunks.clear();
+    std::vector<uint8_t> buffer(2 * BLOCK_SIZE);
+    size_t start = 0, filled = 0;
+    while (true) {
+        if (in && filled - start < BLOCK_SIZE) { // a whole block ahead, the cut may land anywhere in it.
+            StageTimer timer(options.stats, &PackStats::io_ns);
+            std::memmove(buffer.data(), buffer.data() + start, filled - start);
+            filled -= start;
+            start = 0;
+            in.read(reinterpret_cast<char*>(buffer.data() + filled), buffer.size() - filled);
+            filled += static_cast<size_t>(in.gcount());
+        }
+        if (start == filled)
+            break;
+        const uint8_t* chunk = buffer.data() + start;
+        size_t size = options.chunks ? ChunkCut(chunk, filled - start, BLOCK_SIZE) : std::min(filled - start, BLOCK_SIZE);
+        ChunkSource source{ file, entry.raw_size };
+        start += size;
+        entry.raw_size += size;
+        entry.crc = crc32(entry.crc, chunk, static_cast<uInt>(size));
+        ChunkKey chunk_key{ Hash64(chunk, size), size };
+        bool fresh;
+        ChunkSource first;
+        {
+            std::lock_guard<std::mutex> guard(store.lock);
+            auto found = store.ids.find(chunk_key);
+            fresh = found == store.ids.end();
+            if (fresh)
+                found = store.ids.emplace(chunk_key, store.NewId(source)).first;
+            chunks.push_back(found->second);
+            first = store.sources[found->second];
+        }
+        if (!fresh && !FileHolds(folder_path / file_list[first.file], first.offset, chunk, size, options.stats)) {
+            fresh = true; // same hash, other bytes.
+            std::lock_guard<std::mutex> guard(store.lock);
+            chunks.back() = store.NewId(source);
+        }
+        else if (!fresh && std::make_pair(file, source.offset) < std::make_pair(first.file, first.offset)) {
+            // read first by a reader further on. this copy comes first in the body, it takes the table's place and
+            // the other one, and whatever points at it already, is written here instead. once it is in the table,
+            // what comes after it is the same bytes, a copy that got ahead of it in the meantime included.
+            std::lock_guard<std::mutex> guard(store.lock);
+            size_t& owner = store.ids[chunk_key];
+            first = store.sources[owner];
+            if (std::make_pair(file, source.offset) < std::make_pair(first.file, first.offset)) {
+                fresh = true;
+                chunks.back() = store.NewId(source);
+                store.earlier[owner] = chunks.back();
+                owner = chunks.back();
+                AddStat(options.stats, &PackStats::dedup_chunks, 1);
+                AddStat(options.stats, &PackStats::dedup_bytes, size);
+            }
+            else
+                chunks.back() = owner;
+        }
+        if (!fresh) {
+            AddStat(options.stats, &PackStats::dedup_chunks, 1);
+            AddStat(options.stats, &PackStats::dedup_bytes, size);
+            AddStat(options.stats, &PackStats::done, size);
+            continue;
+        }
+        if (!emit(chunks.back(), std::vector<uint8_t>(chunk, chunk + size)))
+            return; // the run failed elsewhere.
+    }
+    if (in.bad())
+        throw std::runtime_error("Error reading file: " + full_path.string());
+}
+
+// solid mode: small files back to back in one record, so they share the match window and the huffman tables instead of
+// each starting cold. sorted by extension first, files of a kind compress best next to each other. a group stays
+// within a block, so any member is one record away.
+inline std::vector<std::vector<size_t>> SolidGroups(const std::vector<fs::path>& file_list, const std::vector<uintmax_t>& sizes,
+    std::vector<size_t> small) {
+    std::stable_sort(small.begin(), small.end(), [&](size_t a, size_t b) {
+        return std::make_pair(file_list[a].extension(), file_list[a].filename()) <
+            std::make_pair(file_list[b].extension(), file_list[b].filename());
+        });
+    std::vector<std::vector<size_t>> groups;
+    uint64_t filled = BLOCK_SIZE;
+    for (size_t i : small) {
+        if (filled + sizes[i] > BLOCK_SIZE) {
+            groups.emplace_back();
+            filled = 0;
+        }
+        groups.back().push_back(i);
+        filled += sizes[i];
+    }
+    return groups;
+}
+
+// reads the members of a group into one block, emitted to be compressed as a single record. a member the store has
+// seen already, in this group or another, points there instead and leaves the block. the members are read at once,
+// then added to the store when it is the group's turn, after every group before it in entry order, so which copy is
+// kept never depends on the readers. a file that grew since it was listed is cut at its listed size, so the group
+// never outgrows the block.
+template <typename Emit>
+void ReadSolidGroup(const fs::path& folder_path, const std::vector<fs::path>& file_list, const std::vector<uintmax_t>& sizes,
+    const std::vector<size_t>& members, size_t turn, std::vector<FolderEntry>& entries, std::vector<std::vector<size_t>>& chunks,
+    ChunkStore& store, Emit&& emit, const PackOptions& options) {
+    std::vector<uint8_t> block;
+    block.reserve(BLOCK_SIZE);
+    std::vector<uint64_t> starts;
+    for (size_t i : members) {
+        fs::path full_path = folder_path / file_list[i];
+        size_t start = block.size();
+        {
+            StageTimer timer(options.stats, &PackStats::io_ns);
+            std::ifstream in(full_path, std::ios::binary);
+            if (!in)
+                throw std::runtime_error("Error opening file: " + full_path.string());
+            block.resize(start + static_cast<size_t>(sizes[i]));
+            in.read(reinterpret_cast<char*>(block.data() + start), static_cast<std::streamsize>(sizes[i]));
+            block.resize(start + static_cast<size_t>(in.gcount()));
+            if (in.bad())
+                throw std::runtime_error("Error reading file: " + full_path.string());
+        }
+        FolderEntry& entry = entries[i];
+        entry.raw_size = block.size() - start;
+        entry.crc = static_cast<uint32_t>(crc32(crc32(0L, Z_NULL, 0), block.data() + start, static_cast<uInt>(entry.raw_size)));
+        starts.push_back(start);
+    }
+    if (!store.WaitTurn(turn))
+        return; // the run failed elsewhere.
+    size_t id;
+    {
+        std::lock_guard<std::mutex> guard(store.lock);
+        id = store.NewId();
+    }
+    size_t kept = 0; // the members that stay are moved down over the ones that left.
+    for (size_t m = 0; m < members.size(); ++m) {
+        size_t i = members[m];
+        FolderEntry& entry = entries[i];
+        size_t size = static_cast<size_t>(entry.raw_size);
+        std::memmove(block.data() + kept, block.data() + starts[m], size);
+        const uint8_t* data = block.data() + kept;
+        ChunkKey member_key{ Hash64(data, size), entry.raw_size };
+        SolidMember place;
+        {
+            std::lock_guard<std::mutex> guard(store.lock);
+            place = store.members.try_emplace(member_key, SolidMember{ id, kept, i }).first->second;
+        }
+        if (place.id != id || place.skip != kept) { // seen before, in this group or another one.
+            bool same = place.id == id ? std::memcmp(block.data() + place.skip, data, size) == 0 :
+                FileHolds(folder_path / file_list[place.file], 0, data, size, options.stats);
+            if (!same)
+                place = { id, kept, i }; // same hash, other bytes, it stays where it is.
+        }
+        chunks[i].assign(1, place.id);
+        entry.skip = place.skip;
+        if (place.id != id || place.skip != kept) { // a copy of an earlier member, of this group or another.
+            AddStat(options.stats, &PackStats::dedup_chunks, 1);
+            AddStat(options.stats, &PackStats::dedup_bytes, entry.raw_size);
+            AddStat(options.stats, &PackStats::done, entry.raw_size);
+        }
+        else
+            kept += size;
+    }
+    store.EndTurn();
+    block.resize(kept);
+    if (!block.empty()) // a group of copies only is never pointed at, nor written.
+        emit(id, std::move(block));
+}
+
+// packs the listed files of the folder into 'out', big files chunk by chunk, small ones in solid groups. tiny files are
+// always grouped, a block header, crc and cold tables each would cost them more than the legacy format's one stream.
+// options.readers threads read, hash and dedup ahead while the workers compress. the records are written in entry order
+// as soon as they are due. a file or a group is a task, its records go out together. the writer's window holds
+// 2 * jobs blocks, and the file being written counts against it too, so a block that is slow to compress stops its
+// reader instead of letting the rest of a big file pile up behind it. add a block per reader and what the queue holds,
+// that is all the memory a pack takes however big the folder or a file in it is. extents, size and crc of the entries
+// are filled in, path and mtime are the caller's.
+inline void PackFolderFiles(const fs::path& folder_path, const FolderScan& scan, const std::vector<size_t>& files,
+    std::vector<FolderEntry>& entries, std::ofstream& out, const std::vector<uint8_t>& key, uint64_t& offset, const PackOptions& options) {
+    const std::vector<fs::path>& file_list = scan.files;
+    const std::vector<uintmax_t>& sizes = scan.sizes;
+    const uint64_t solid_max = options.solid ? SOLID_FILE_MAX : SOLID_AUTO_MAX;
+    std::vector<size_t> large, small;
+    for (size_t i : files)
+        (sizes[i] > 0 && sizes[i] <= solid_max ? small : large).push_back(i);
+    std::vector<std::vector<size_t>> groups = SolidGroups(file_list, sizes, small);
+    std::vector<std::pair<size_t, size_t>> tasks; // first entry, then a large file or, past them, a group.
+    for (size_t n = 0; n < large.size(); ++n)
+        tasks.push_back({ large[n], n });
+    for (size_t g = 0; g < groups.size(); ++g)
+        tasks.push_back({ *std::min_element(groups[g].begin(), groups[g].end()), large.size() + g });
+    std::sort(tasks.begin(), tasks.end());
+    std::vector<size_t> turns(groups.size()); // of each group, in task order.
+    for (size_t n = 0, turn = 0; n < tasks.size(); ++n) {
+        if (tasks[n].second >= large.size())
+            turns[tasks[n].second - large.size()] = turn++;
+    }
+    std::vector<std::vector<size_t>> chunks(entries.size()); // chunk ids per entry.
+    ChunkStore store;
+    auto write = [&](PackJob& job) {
+        {
+            std::lock_guard<std::mutex> guard(store.lock);
+            if (store.earlier.count(job.id))
+                return; // an earlier copy was written instead, it had its turn already.
+        }
+        Extent place{ offset, job.data.size() };
+        WriteXored(out, job.data, key, offset, options.stats);
+        std::vector<uint8_t>().swap(job.data);
+        std::lock_guard<std::mutex> guard(store.lock);
+        store.placed[job.id] = place;
+        };
+    OrderedWriter<PackJob, decltype(write)> writer(tasks.size(), 2 * options.jobs, write);
+    Pipeline<PackJob>(tasks.size(), options.readers, options.jobs, 2 * options.jobs,
+        [&](size_t n, BoundedQueue<PackJob>& queue) {
+            try {
+                size_t count = 0;
+                auto emit = [&](size_t id, std::vector<uint8_t> data) {
+                    if (!writer.Admit(n) || !queue.Push({ n, count, id, std::move(data) }))
+                        return false;
+                    count++;
+                    return true;
+                    };
+                size_t task = tasks[n].second;
+                if (task >= large.size())
+                    ReadSolidGroup(folder_path, file_list, sizes, groups[task - large.size()], turns[task - large.size()], entries,
+                        chunks, store, emit, options);
+                else
+                    ReadFolderEntry(folder_path, file_list, large[task], entries[large[task]], chunks[large[task]], store, emit, options);
+                writer.Finish(n, count);
+            }
+            catch (...) {
+                writer.Close();
+                store.Fail();
+                throw;
+            }
+        },
+        [&](PackJob& job) {
+            try {
+                job.data = E_CompressBlock(job.data, options);
+                writer.Put(job.task, job.index, std::move(job));
+            }
+            catch (...) {
+                writer.Close();
+                throw;
+            }
+        });
+    for (size_t i : files) { // every record is out, a copy may point at one written after it.
+        for (size_t id : chunks[i]) {
+            const Extent& place = store.placed[store.Written(id)];
+            AddExtent(entries[i].extents, place.offset, place.stored_size);
+        }
+    }
+}
+
+inline void WriteFolderDirectory(std::ofstream& out, const std::vector<FolderEntry>& entries, const std::vector<uint8_t>& key,
+    uint64_t& offset, PackStats* stats = nullptr) { // directory and trailer, right after the last record.
+    std::vector<uint8_t> directory;
+    directory.push_back(INDEX_VERSION);
+    PutLE(directory, BLOCK_SIZE, 8);
+    PutLE(directory, entries.size(), 8);
+    for (const auto& entry : entries) {
+        PutLE(directory, entry.path.size(), 4);
+        directory.insert(directory.end(), entry.path.begin(), entry.path.end());
+        PutLE(directory, entry.raw_size, 8);
+        PutLE(directory, entry.crc, 4);
+        PutLE(directory, static_cast<uint64_t>(entry.mtime), 8);
+        PutLE(directory, entry.skip, 8);
+        PutLE(directory, entry.extents.size(), 4);
+        for (const auto& extent : entry.extents) {
+            PutLE(directory, extent.offset, 8);
+            PutLE(directory, extent.stored_size, 8);
+        }
+    }
+    uint64_t directory_offset = offset;
+    std::vector<uint8_t> trailer;
+    PutLE(trailer, directory_offset, 8);
+    PutLE(trailer, directory.size(), 8);
+    trailer.insert(trailer.end(), INDEX_MAGIC, INDEX_MAGIC + MAGIC_SIZE);
+    WriteXored(out, directory, key, offset, stats);
+    WriteXored(out, trailer, key, offset, stats);
+}
+
+inline void WriteFolderArchive(const fs::path& folder_path, const std::string& archive_file, const std::vector<uint8_t>& key, const PackOptions& options = {}) {
+    FolderScan scan = ScanFolder(folder_path, options.jobs);
+    std::vector<FolderEntry> entries(scan.files.size());
+    std::vector<size_t> files(scan.files.size());
+    for (size_t i = 0; i < scan.files.size(); ++i) {
+        entries[i].path = scan.files[i].generic_string();
+        entries[i].mtime = scan.mtimes[i];
+        files[i] = i;
+        AddStat(options.stats, &PackStats::total, scan.sizes[i]);
+    }
+    std::ofstream out(archive_file, std::ios::binary);
+    if (!out)
+        throw std::runtime_error("Error opening file: " + archive_file);
+    std::vector<uint8_t> header;
+    WriteArchiveHeader(header, key, true);
+    header.back() = INDEXED_FOLDER;
+    out.write(reinterpret_cast<const char*>(header.data()), header.size());
+    uint64_t offset = 0;
+    PackFolderFiles(folder_path, scan, files, entries, out, key, offset, options);
+    WriteFolderDirectory(out, entries, key, offset, options.stats);
+}
+
+inline FolderIndex ReadFolderIndex(ByteView body, const std::vector<uint8_t>& key) { // only the tail of the archive is touched.
+    uint64_t body_size = body.size();
+    if (body_size < INDEX_TRAILER_SIZE)
+        throw std::runtime_error("corrupted archive: missing directory trailer.");
+    uint8_t trailer[INDEX_TRAILER_SIZE];
+    ReadXored(body, body_size - INDEX_TRAILER_SIZE, trailer, INDEX_TRAILER_SIZE, key);
+    if (memcmp(trailer + 16, INDEX_MAGIC, MAGIC_SIZE) != 0)
+        throw std::runtime_error("corrupted archive: invalid directory trailer.");
+    uint64_t directory_offset = GetLE(trailer, 8), directory_size = GetLE(trailer + 8, 8);
+    if (directory_offset > body_size - INDEX_TRAILER_SIZE || directory_size != body_size - INDEX_TRAILER_SIZE - directory_offset)
+        throw std::runtime_error("corrupted archive: invalid directory location.");
+    std::vector<uint8_t> directory(static_cast<size_t>(directory_size));
+    ReadXored(body, directory_offset, directory.data(), directory.size(), key);
+    size_t pos = 0;
+    auto Need = [&](size_t n) {
+        if (directory.size() - pos < n)
+            throw std::runtime_error("corrupted archive: truncated directory.");
+        };
+    Need(17);
+    uint8_t version = directory[pos++];
+    if (version < 1 || version > INDEX_VERSION)
+        throw std::runtime_error("unsupported archive directory version.");
+    FolderIndex index;
+    index.block_size = GetLE(&directory[pos], 8);
+    uint64_t count = GetLE(&directory[pos + 8], 8);
+    pos += 16;
+    if (index.block_size == 0 || count > directory.size() / 28)
+        throw std::runtime_error("corrupted archive: invalid directory header.");
+    index.entries.resize(static_cast<size_t>(count));
+    for (auto& entry : index.entries) {
+        Need(4);
+        size_t path_length = static_cast<size_t>(GetLE(&directory[pos], 4));
+        pos += 4;
+        Need(path_length);
+        entry.path.assign(reinterpret_cast<const char*>(&directory[pos]), path_length);
+        pos += path_length;
+        if (version < 3) { // one extent, in front of the sizes.
+            size_t entry_size = version == 1 ? 28 : 36;
+            Need(entry_size);
+            Extent extent{ GetLE(&directory[pos], 8), GetLE(&directory[pos + 8], 8) };
+            if (extent.stored_size)
+                entry.extents.push_back(extent);
+            entry.raw_size = GetLE(&directory[pos + 16], 8);
+            entry.crc = static_cast<uint32_t>(GetLE(&directory[pos + 24], 4));
+            if (version == 2)
+                entry.mtime = static_cast<int64_t>(GetLE(&directory[pos + 28], 8));
+            pos += entry_size;
+        }
+        else {
+            Need(version >= 4 ? 32 : 24);
+            entry.raw_size = GetLE(&directory[pos], 8);
+            entry.crc = static_cast<uint32_t>(GetLE(&directory[pos + 8], 4));
+            entry.mtime = static_cast<int64_t>(GetLE(&directory[pos + 12], 8));
+            pos += 20;
+            if (version >= 4) {
+                entry.skip = GetLE(&directory[pos], 8);
+                pos += 8;
+            }
+            uint64_t extent_count = GetLE(&directory[pos], 4);
+            pos += 4;
+            if (extent_count > (directory.size() - pos) / 16)
+                throw std::runtime_error("corrupted archive: truncated directory.");
+            entry.extents.resize(static_cast<size_t>(extent_count));
+            for (auto& extent : entry.extents) {
+                extent.offset = GetLE(&directory[pos], 8);
+                extent.stored_size = GetLE(&directory[pos + 8], 8);
+                pos += 16;
+            }
+        }
+        for (const auto& extent : entry.extents) {
+            if (extent.offset > directory_offset || extent.stored_size > directory_offset - extent.offset)
+                throw std::runtime_error("corrupted archive: entry outside of the data area: " + entry.path);
+        }
+        if (!SafeEntryPath(entry.path))
+            throw std::runtime_error("corrupted archive: unsafe entry path: " + entry.path);
+    }
+    index.data_size = directory_offset;
+    return index;
+}
+
+inline std::vector<RecordRef> ScanRecords(ByteView body, const std::vector<uint8_t>& key, uint64_t start, uint64_t end,
+    uint64_t block_size) { // walks the record headers in [start, end) of the body, nothing is decoded yet.
+    std::vector<RecordRef> records;
+    uint64_t pos = start, raw_offset = 0;
+    while (pos < end) {
+        if (end - pos < BLOCK_HEADER_SIZE)
+            throw std::runtime_error("corrupted archive: truncated block record.");
+        uint8_t head[BLOCK_HEADER_SIZE];
+        ReadXored(body, pos, head, BLOCK_HEADER_SIZE, key);
+        uint64_t comp_size = GetLE(head + 16, 8);
+        if (comp_size > end - pos - BLOCK_HEADER_SIZE)
+            throw std::runtime_error("corrupted archive: truncated block record.");
+        RecordRef ref;
+        ref.offset = pos;
+        ref.size = BLOCK_HEADER_SIZE + comp_size;
+        ref.raw_offset = raw_offset;
+        ref.raw_size = GetLE(head, 8);
+        if (ref.raw_size > block_size)
+            throw std::runtime_error("corrupted archive: invalid block header.");
+        raw_offset += ref.raw_size;
+        pos += ref.size;
+        records.push_back(ref);
+    }
+    return records;
+}
+
+inline std::vector<RecordRef> EntryRecords(ByteView body, const std::vector<uint8_t>& key, const FolderEntry& entry,
+    uint64_t block_size) { // the records of every extent, raw offsets running on from one to the next.
+    std::vector<RecordRef> records;
+    uint64_t raw_offset = 0;
+    for (const auto& extent : entry.extents) {
+        for (RecordRef ref : ScanRecords(body, key, extent.offset, extent.offset + extent.stored_size, block_size)) {
+            ref.raw_offset += raw_offset;
+            records.push_back(ref);
+        }
+        if (!records.empty())
+            raw_offset = records.back().raw_offset + records.back().raw_size;
+    }
+    return records;
+}
+
+inline void ExtractFolderIndexed(ByteView body, const std::vector<uint8_t>& key, const fs::path& out_folder,
+    const std::string& pattern, const PackOptions& options = {}) { // empty pattern takes everything.
+    FolderIndex index = ReadFolderIndex(body, key);
+    std::vector<const FolderEntry*> selected;
+    for (const auto& entry : index.entries) {
+        if (pattern.empty() || GlobMatch(pattern.c_str(), entry.path.c_str()))
+            selected.push_back(&entry);
+    }
+    if (!pattern.empty() && selected.empty())
+        throw std::runtime_error("no entry matches '" + pattern + "'.");
+    std::vector<std::vector<RecordRef>> records(selected.size()); // the whole entry table, before anything is decoded.
+    ParallelFor(selected.size(), options.jobs, [&](size_t n) {
+        records[n] = EntryRecords(body, key, *selected[n], index.block_size);
+        });
+    // an entry that is only part of its records sits in a solid group. those go last, a group at a time, so every
+    // group is decoded once however many members are asked for.
+    std::vector<size_t> solid;
+    for (size_t n = 0; n < selected.size(); ++n) {
+        const FolderEntry& entry = *selected[n];
+        uint64_t decoded = RecordsRawSize(records[n]);
+        if (entry.skip > decoded || entry.raw_size > decoded - entry.skip)
+            throw std::runtime_error("corrupted archive: size mismatch for " + entry.path);
+        if (decoded != entry.raw_size)
+            solid.push_back(n);
+        else
+            AddStat(options.stats, &PackStats::total, entry.raw_size);
+    }
+    std::stable_sort(solid.begin(), solid.end(), [&](size_t a, size_t b) {
+        return std::make_pair(selected[a]->extents[0].offset, selected[a]->skip) <
+            std::make_pair(selected[b]->extents[0].offset, selected[b]->skip);
+        });
+    for (size_t n = 0; n < solid.size(); ++n) {
+        if (n == 0 || selected[solid[n]]->extents[0].offset != selected[solid[n - 1]]->extents[0].offset)
+            AddStat(options.stats, &PackStats::total, RecordsRawSize(records[solid[n]]));
+    }
+    std::vector<fs::path> parents;
+    for (const FolderEntry* entry : selected)
+        parents.push_back(fs::path(entry->path).parent_path());
+    CreateParentFolders(out_folder, std::move(parents), options.stats);
+    ExtractLog log(options.quiet);
+    auto ExtractDirect = [&](size_t n) { // decoded straight into the mapped output, over every worker if it has the records.
+        const FolderEntry& entry = *selected[n];
+        fs::path output_path = out_folder / fs::path(entry.path);
+        MappedFile out;
+        {
+            StageTimer timer(options.stats, &PackStats::io_ns);
+            out = MappedFile::Create(output_path.string(), entry.raw_size);
+        }
+        uLong crc = DecodeRecordsInto(body, key, records[n], index.block_size, out.data(), options, true);
+        if (crc != entry.crc)
+            throw std::runtime_error("corrupted archive: checksum mismatch for " + entry.path);
+        {
+            StageTimer timer(options.stats, &PackStats::io_ns);
+            out.Close();
+        }
+        log.Add(output_path);
+        };
+    // entries of several records spread over the workers one at a time. everything else is one record or one solid
+    // group, those are shared out whole, biggest first, so each worker keeps its decoder for the whole run.
+    std::vector<std::pair<uint64_t, size_t>> tasks; // raw size, then a direct entry or, past them, a group start in 'solid'.
+    for (size_t n = 0; n < selected.size(); ++n) {
+        if (RecordsRawSize(records[n]) != selected[n]->raw_size)
+            continue;
+        if (records[n].size() > 1)
+            ExtractDirect(n);
+        else
+            tasks.push_back({ selected[n]->raw_size, n });
+    }
+    for (size_t g = 0; g < solid.size(); ++g) {
+        if (g == 0 || selected[solid[g]]->extents[0].offset != selected[solid[g - 1]]->extents[0].offset)
+            tasks.push_back({ RecordsRawSize(records[solid[g]]), selected.size() + g });
+    }
+    std::stable_sort(tasks.begin(), tasks.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+    ParallelFor(tasks.size(), options.jobs, [&](size_t t) {
+        size_t task = tasks[t].second;
+        if (task < selected.size()) {
+            ExtractDirect(task);
+            return;
+        }
+        size_t first = task - selected.size();
+        uint64_t group_offset = selected[solid[first]]->extents[0].offset;
+        thread_local std::vector<uint8_t> group;
+        group.resize(static_cast<size_t>(RecordsRawSize(records[solid[first]])));
+        DecodeRecordsInto(body, key, records[solid[first]], index.block_size, group.data(), options);
+        for (size_t g = first; g < solid.size() && selected[solid[g]]->extents[0].offset == group_offset; ++g) {
+            const FolderEntry& entry = *selected[solid[g]];
+            const uint8_t* data = group.data() + entry.skip;
+            if (crc32(crc32(0L, Z_NULL, 0), data, static_cast<uInt>(entry.raw_size)) != entry.crc)
+                throw std::runtime_error("corrupted archive: checksum mismatch for " + entry.path);
+            fs::path output_path = out_folder / fs::path(entry.path);
+            {
+                StageTimer timer(options.stats, &PackStats::io_ns);
+                Write(output_path.string(), ByteView(data, static_cast<size_t>(entry.raw_size)));
+            }
+            log.Add(output_path);
+        }
+        });
+}
+
+inline void ExtractFolder(const std::string& archive_file, const fs::path& out_folder, const std::string& pattern = "", const PackOptions& options = {}) {
+    MappedFile archive(archive_file);
+    std::vector<uint8_t> key;
+    uint8_t flags = 0;
+    ByteView body = ArchiveBody(archive.view(), key, flags);
+    if (flags == INDEXED_FOLDER) {
+        ExtractFolderIndexed(body, key, out_folder, pattern, options);
+        return;
+    }
+    if (!pattern.empty())
+        throw std::runtime_error("this archive has no directory, single entries cant be extracted. drop the pattern.");
+    archive.Close();
+    ExtractFolderArchive(archive_file, out_folder, options);
+}
+
+inline void ListArchive(const std::string& archive_file) { // 'l' mode, reads the directory only.
+    MappedFile archive(archive_file);
+    std::vector<uint8_t> key;
+    uint8_t flags = 0;
+    ByteView body = ArchiveBody(archive.view(), key, flags);
+    if (flags != INDEXED_FOLDER)
+        throw std::runtime_error("only indexed folder archives can be listed.");
+    FolderIndex index = ReadFolderIndex(body, key);
+    uint64_t raw_total = 0;
+    std::printf("%14s %14s  %-8s  %s\n", "size", "stored", "crc32", "path");
+    for (const auto& entry : index.entries) {
+        std::printf("%14llu %14llu  %08x  %s\n", static_cast<unsigned long long>(entry.raw_size),
+            static_cast<unsigned long long>(entry.StoredSize()), entry.crc, entry.path.c_str());
+        raw_total += entry.raw_size;
+    }
+    // shared records are in several lines above but only once in the archive.
+    std::printf("%14llu %14llu            %zu entries\n", static_cast<unsigned long long>(raw_total),
+        static_cast<unsigned long long>(index.data_size), index.entries.size());
+}
+
+struct VerifySummary { // what a 't' run went through.
+    uint64_t entries = 0; // files, one for a file archive.
+    uint64_t blocks = 0; // records decoded, a shared one once.
+    uint64_t unchecked = 0; // of those, records from before block checksums. only their sizes could be checked.
+    uint64_t raw_bytes = 0;
+};
+
+// decrypts and decodes one record into buffers of the calling thread, the raw data stays valid until its next call.
+// the block checksum is checked by the decoder, 'checked' tells whether the record had one.
+inline ByteView DecodeRecordScratch(ByteView body, const std::vector<uint8_t>& key, const RecordRef& ref, uint64_t block_size,
+    bool& checked, PackStats* stats = nullptr) {
+    thread_local std::vector<uint8_t> record, raw;
+    record.resize(static_cast<size_t>(ref.size));
+    ReadXored(body, ref.offset, record.data(), record.size(), key, stats);
+    checked = record.size() >= BLOCK_HEADER_SIZE && (record[15] & BLOCK_CHECKSUM); // top byte of the lzss size.
+    raw.resize(static_cast<size_t>(ref.raw_size));
+    D_DecompressBlock(record, block_size, raw.data(), ref.raw_size, stats);
+    return raw;
+}
+
+// every record of an indexed folder decoded once on the workers and dropped, then every entry checked against its
+// crc32. a direct entry's crc is put together from the crcs of its records, a solid member is cut out of its group
+// while the group is decoded.
+inline VerifySummary VerifyFolderIndexed(ByteView body, const std::vector<uint8_t>& key, const PackOptions& options = {}) {
+    FolderIndex index = ReadFolderIndex(body, key);
+    const std::vector<FolderEntry>& entries = index.entries;
+    std::vector<std::vector<RecordRef>> records(entries.size());
+    ParallelFor(entries.size(), options.jobs, [&](size_t n) {
+        records[n] = EntryRecords(body, key, entries[n], index.block_size);
+        });
+    std::vector<RecordRef> blocks; // a record shared by several entries is in here once.
+    std::unordered_map<uint64_t, size_t> block_at; // body offset -> index in 'blocks'.
+    for (const auto& entry_records : records) {
+        for (const RecordRef& ref : entry_records) {
+            if (block_at.try_emplace(ref.offset, blocks.size()).second)
+                blocks.push_back(ref);
+        }
+    }
+    std::vector<std::vector<size_t>> members(blocks.size()); // solid members cut out of each record.
+    for (size_t n = 0; n < entries.size(); ++n) {
+        uint64_t decoded = RecordsRawSize(records[n]);
+        if (entries[n].skip > decoded || entries[n].raw_size > decoded - entries[n].skip)
+            throw std::runtime_error("corrupted archive: size mismatch for " + entries[n].path);
+        if (decoded == entries[n].raw_size)
+            continue;
+        if (records[n].size() != 1) // a group never spans records.
+            throw std::runtime_error("corrupted archive: size mismatch for " + entries[n].path);
+        members[block_at[records[n][0].offset]].push_back(n);
+    }
+    VerifySummary summary;
+    summary.entries = entries.size();
+    summary.blocks = blocks.size();
+    for (const RecordRef& ref : blocks) {
+        summary.raw_bytes += ref.raw_size;
+        AddStat(options.stats, &PackStats::total, ref.raw_size);
+    }
+    std::vector<uLong> block_crcs(blocks.size());
+    std::vector<uLong> member_crcs(entries.size());
+    std::atomic<uint64_t> unchecked{ 0 };
+    ParallelFor(blocks.size(), options.jobs, [&](size_t b) {
+        bool checked = false;
+        ByteView raw = DecodeRecordScratch(body, key, blocks[b], index.block_size, checked, options.stats);
+        if (!checked)
+            unchecked++;
+        block_crcs[b] = crc32(crc32(0L, Z_NULL, 0), raw.data(), static_cast<uInt>(raw.size()));
+        for (size_t n : members[b]) {
+            member_crcs[n] = crc32(crc32(0L, Z_NULL, 0), raw.data() + entries[n].skip,
+                static_cast<uInt>(entries[n].raw_size));
+        }
+        });
+    summary.unchecked = unchecked;
+    for (size_t n = 0; n < entries.size(); ++n) {
+        uLong crc = crc32(0L, Z_NULL, 0);
+        if (RecordsRawSize(records[n]) == entries[n].raw_size) {
+            for (const RecordRef& ref : records[n])
+                crc = crc32_combine(crc, block_crcs[block_at[ref.offset]], static_cast<z_off_t>(ref.raw_size));
+        }
+        else
+            crc = member_crcs[n];
+        if (crc != entries[n].crc)
+            throw std::runtime_error("corrupted archive: checksum mismatch for " + entries[n].path);
+    }
+    return summary;
+}
+
+// 't' mode: decodes the whole archive on the workers and throws the output away, nothing is written. block checksums,
+// entry crcs and every size in the archive are checked, the first thing that is off is thrown. the old formats have no
+// checksums, they are only decoded.
+inline VerifySummary VerifyArchive(const std::string& archive_file, const PackOptions& options = {}) {
+    MappedFile archive(archive_file);
+    std::vector<uint8_t> key;
+    uint8_t flags = 0;
+    ByteView body = ArchiveBody(archive.view(), key, flags);
+    if (flags == INDEXED_FOLDER)
+        return VerifyFolderIndexed(body, key, options);
+    VerifySummary summary;
+    if (flags == STREAM_FLAG) {
+        uint64_t block_size = 0;
+        std::vector<RecordRef> records = StreamRecords(body, key, block_size);
+        summary.entries = 1;
+        summary.blocks = records.size();
+        summary.raw_bytes = RecordsRawSize(records);
+        AddStat(options.stats, &PackStats::total, summary.raw_bytes);
+        std::atomic<uint64_t> unchecked{ 0 };
+        ParallelFor(records.size(), options.jobs, [&](size_t i) {
+            bool checked = false;
+            DecodeRecordScratch(body, key, records[i], block_size, checked, options.stats);
+            if (!checked)
+                unchecked++;
+            });
+        summary.unchecked = unchecked;
+        return summary;
+    }
+    if (flags == FOLDER_FLAG) {
+        std::vector<uint8_t> payload = a_xor(body, key);
+        std::vector<LegacyEntry> entries = LegacyFolderEntries(payload);
+        std::atomic<uint64_t> raw_bytes{ 0 };
+        ParallelFor(entries.size(), options.jobs, [&](size_t i) {
+            raw_bytes += D_DecompressFile(ByteView(payload).subspan(entries[i].offset, entries[i].size), key).size();
+            });
+        summary.entries = summary.blocks = summary.unchecked = entries.size();
+        summary.raw_bytes = raw_bytes;
+        return summary;
+    }
+    summary.raw_bytes = D_DecompressFile(body, key).size();
+    summary.entries = summary.blocks = summary.unchecked = 1;
+    return summary;
+}
+
+inline uint32_t FileCrc(const fs::path& path, PackStats* stats = nullptr) { // zlib crc32 of a file on disk, read in blocks.
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Error opening file: " + path.string());
+    uLong crc = crc32(0L, Z_NULL, 0);
+    std::vector<uint8_t> block(BLOCK_SIZE);
+    while (in) {
+        {
+            StageTimer timer(stats, &PackStats::io_ns);
+            in.read(reinterpret_cast<char*>(block.data()), block.size());
+        }
+        crc = crc32(crc, block.data(), static_cast<uInt>(in.gcount()));
+    }
+    if (in.bad())
+        throw std::runtime_error("Error reading file: " + path.string());
+    return static_cast<uint32_t>(crc);
+}
+
+// whether the file on disk holds exactly the raw data of 'entry', its records decoded one at a time and compared as they
+// come. a crc32 that matches is not proof, 'u' asks this before it keeps the records of a file whose mtime moved.
+inline bool EntryMatchesFile(ByteView body, const std::vector<uint8_t>& key, const FolderEntry& entry, uint64_t block_size,
+    const fs::path& path, PackStats* stats = nullptr) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        throw std::runtime_error("Error opening file: " + path.string());
+    std::vector<uint8_t> disk;
+    uint64_t skip = entry.skip, left = entry.raw_size;
+    for (const RecordRef& ref : EntryRecords(body, key, entry, block_size)) {
+        if (left == 0)
+            break;
+        bool checked = false;
+        ByteView raw = DecodeRecordScratch(body, key, ref, block_size, checked, stats);
+        size_t from = static_cast<size_t>(std::min<uint64_t>(skip, raw.size()));
+        skip -= from;
+        size_t len = static_cast<size_t>(std::min<uint64_t>(raw.size() - from, left));
+        if (len == 0)
+            continue;
+        disk.resize(len);
+        {
+            StageTimer timer(stats, &PackStats::io_ns);
+            in.read(reinterpret_cast<char*>(disk.data()), static_cast<std::streamsize>(len));
+        }
+        if (static_cast<size_t>(in.gcount()) != len || std::memcmp(disk.data(), raw.data() + from, len) != 0)
+            return false;
+        left -= len;
+    }
+    return left == 0;
+}
+
+struct UpdateSummary {
+    size_t reused = 0; // copied over from the old archive.
+    size_t packed = 0; // new or changed, compressed again.
+    size_t removed = 0; // gone from the folder.
+};
+
+// 'u' mode: brings an indexed folder archive up to date with the folder. an entry whose size and mtime still match
+// is taken as unchanged. with the same size but another mtime the file is read once for its crc32, and when that
+// matches it is compared with the old entry decoded, the crc alone would let a change slip through now and then. unchanged
+// entries keep their block records, they are only re-xored for their new place in the body, nothing is decoded or
+// compressed again, unless they share a solid group with an entry that changed or is gone. the result goes to a temporary file that replaces the archive at the end. an empty key keeps the
+// archive's own.
+inline UpdateSummary UpdateFolderArchive(const fs::path& folder_path, const std::string& archive_file, const std::vector<uint8_t>& new_key,
+    const PackOptions& options = {}) {
+    MappedFile archive(archive_file);
+    std::vector<uint8_t> old_key;
+    uint8_t flags = 0;
+    ByteView body = ArchiveBody(archive.view(), old_key, flags);
+    if (flags != INDEXED_FOLDER)
+        throw std::runtime_error("only indexed folder archives can be updated, recreate it with 'c'.");
+    FolderIndex index = ReadFolderIndex(body, old_key);
+    const std::vector<uint8_t>& key = new_key.empty() ? old_key : new_key;
+    std::unordered_map<std::string, const FolderEntry*> previous;
+    for (const auto& entry : index.entries)
+        previous[entry.path] = &entry;
+    FolderScan scan = ScanFolder(folder_path, options.jobs);
+    const std::vector<fs::path>& file_list = scan.files;
+    const std::vector<uintmax_t>& sizes = scan.sizes;
+    std::vector<FolderEntry> entries(file_list.size());
+    std::vector<const FolderEntry*> reuse(file_list.size(), nullptr); // set where the old records are kept.
+    for (size_t i = 0; i < file_list.size(); ++i) {
+        entries[i].path = file_list[i].generic_string();
+        entries[i].mtime = scan.mtimes[i];
+        AddStat(options.stats, &PackStats::total, sizes[i]);
+    }
+    ParallelFor(file_list.size(), options.jobs, [&](size_t i) { // a crc check and a compare at most, nothing is compressed yet.
+        FolderEntry& entry = entries[i];
+        auto found = previous.find(entry.path);
+        // records of another block size would not match the directory we write.
+        if (found != previous.end() && index.block_size == BLOCK_SIZE && found->second->raw_size == sizes[i]) {
+            const FolderEntry& old = *found->second;
+            fs::path full_path = folder_path / file_list[i];
+            if ((old.mtime != 0 && old.mtime == entry.mtime) || (old.crc == FileCrc(full_path, options.stats) &&
+                EntryMatchesFile(body, old_key, old, index.block_size, full_path, options.stats))) {
+                entry.raw_size = old.raw_size;
+                entry.crc = old.crc;
+                entry.skip = old.skip;
+                reuse[i] = &old;
+            }
+        }
+        });
+    // a solid group that lost a member, changed or removed, is packed again with the members it still has. kept as it
+    // was, the group would carry the dead bytes along, and a folder of tiny files updated a file at a time would grow
+    // with every 'u'.
+    std::vector<bool> kept(index.entries.size(), false);
+    for (const FolderEntry* old : reuse) {
+        if (old)
+            kept[old - index.entries.data()] = true;
+    }
+    std::unordered_set<uint64_t> stale; // first record of each group to pack again.
+    for (size_t n = 0; n < index.entries.size(); ++n) {
+        const FolderEntry& old = index.entries[n];
+        if (!kept[n] && old.extents.size() == 1 && old.raw_size <= SOLID_FILE_MAX && (old.skip > 0 ||
+            RecordsRawSize(EntryRecords(body, old_key, old, index.block_size)) != old.raw_size))
+            stale.insert(old.extents[0].offset);
+    }
+    std::vector<size_t> changed;
+    for (size_t i = 0; i < file_list.size(); ++i) {
+        if (reuse[i] && reuse[i]->extents.size() == 1 && stale.count(reuse[i]->extents[0].offset)) {
+            reuse[i] = nullptr;
+            entries[i].raw_size = entries[i].crc = 0;
+            entries[i].skip = 0;
+        }
+        if (reuse[i])
+            AddStat(options.stats, &PackStats::done, entries[i].raw_size);
+        else
+            changed.push_back(i);
+    }
+    UpdateSummary summary;
+    std::string temp_file = archive_file + ".tmp";
+    try {
+        std::ofstream out(temp_file, std::ios::binary);
+        if (!out)
+            throw std::runtime_error("Error opening file: " + temp_file);
+        std::vector<uint8_t> header;
+        WriteArchiveHeader(header, key, true);
+        header.back() = INDEXED_FOLDER;
+        out.write(reinterpret_cast<const char*>(header.data()), header.size());
+        uint64_t offset = 0;
+        std::vector<uint8_t> record;
+        std::unordered_map<uint64_t, Extent> moved; // old record offset -> new place, shared records move once.
+        for (size_t i = 0; i < entries.size(); ++i) {
+            if (!reuse[i])
+                continue;
+            // decrypted at the old place, encrypted at the new one, a record at a time.
+            for (const RecordRef& ref : EntryRecords(body, old_key, *reuse[i], index.block_size)) {
+                auto [found, fresh] = moved.try_emplace(ref.offset);
+                if (fresh) {
+                    record.resize(static_cast<size_t>(ref.size));
+                    {
+                        StageTimer timer(options.stats, &PackStats::xor_ns);
+                        ReadXored(body, ref.offset, record.data(), record.size(), old_key);
+                    }
+                    found->second = { offset, ref.size };
+                    WriteXored(out, record, key, offset, options.stats);
+                }
+                AddExtent(entries[i].extents, found->second.offset, found->second.stored_size);
+            }
+            summary.reused++;
+        }
+        // new and changed files after the kept records, they dedup among themselves.
+        PackFolderFiles(folder_path, scan, changed, entries, out, key, offset, options);
+        summary.packed = changed.size();
+        WriteFolderDirectory(out, entries, key, offset, options.stats);
+        out.close();
+        if (!out)
+            throw std::runtime_error("error writing archive data.");
+    }
+    catch (...) {
+        std::error_code ignored;
+        fs::remove(temp_file, ignored);
+        throw;
+    }
+    summary.removed = index.entries.size() - summary.reused;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (!reuse[i] && previous.count(entries[i].path))
+            summary.removed--; // changed, not removed.
+    }
+    archive.Close(); // windows wont replace a mapped file.
+    fs::rename(temp_file, archive_file);
+    return summary;
 }
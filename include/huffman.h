@@ -0,0 +1,294 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "kernels.h"
+// includes
+
+// entropy coder for the lzss token stream, so a block needs one match search instead of ours plus zlib's.
+// literals and match lengths share one huffman alphabet, offsets get another one: the bucket is the bit length of
+// the offset, the bits below the top one follow raw. both tables are built per block and stored as 4-bit code
+// lengths, [literal/length lengths: 192][offset lengths: 8], then the bit stream, least significant bit first.
+// there is no end symbol, the decoder stops at the raw size it was given.
+constexpr size_t HUFF_MIN_MATCH = 3; // same as MIN and MAX in compressor.h, the token format fixes them.
+constexpr size_t HUFF_MAX_MATCH = 130;
+constexpr size_t HUFF_LITLEN = 256 + (HUFF_MAX_MATCH - HUFF_MIN_MATCH + 1);
+constexpr size_t HUFF_OFFSETS = 16;
+constexpr unsigned HUFF_MAX_BITS = 15;
+constexpr size_t HUFF_HEADER_SIZE = (HUFF_LITLEN + HUFF_OFFSETS) / 2;
+
+// code lengths, none longer than HUFF_MAX_BITS. n is at most HUFF_LITLEN, everything lives on the stack.
+inline void HuffLengths(const uint32_t* counts, size_t n, uint8_t* lengths) {
+    using Node = std::pair<uint64_t, int>;
+    uint32_t freq[HUFF_LITLEN];
+    std::copy(counts, counts + n, freq);
+    while (true) {
+        std::fill(lengths, lengths + n, 0);
+        int parent[2 * HUFF_LITLEN];
+        size_t symbol[HUFF_LITLEN]; // leaf -> symbol, leaves come first.
+        Node heap[HUFF_LITLEN]; // min-heap, a pair of nodes leaves for every one that comes in.
+        size_t nodes = 0, leaves = 0, heap_size = 0;
+        for (size_t i = 0; i < n; ++i) {
+            if (freq[i]) {
+                heap[heap_size++] = { freq[i], static_cast<int>(nodes) };
+                std::push_heap(heap, heap + heap_size, std::greater<Node>());
+                parent[nodes++] = -1;
+                symbol[leaves++] = i;
+            }
+        }
+        if (leaves == 0)
+            return;
+        if (leaves == 1) { // a code needs at least one bit.
+            lengths[symbol[0]] = 1;
+            return;
+        }
+        while (heap_size > 1) {
+            std::pop_heap(heap, heap + heap_size--, std::greater<Node>());
+            Node a = heap[heap_size];
+            std::pop_heap(heap, heap + heap_size--, std::greater<Node>());
+            Node b = heap[heap_size];
+            int id = static_cast<int>(nodes);
+            parent[nodes++] = -1;
+            parent[a.second] = parent[b.second] = id;
+            heap[heap_size++] = { a.first + b.first, id };
+            std::push_heap(heap, heap + heap_size, std::greater<Node>());
+        }
+        unsigned longest = 0;
+        for (size_t leaf = 0; leaf < leaves; ++leaf) {
+            unsigned depth = 0;
+            for (int p = parent[leaf]; p >= 0; p = parent[p])
+                depth++;
+            lengths[symbol[leaf]] = static_cast<uint8_t>(std::min(depth, 255u));
+            longest = std::max(longest, depth);
+        }
+        if (longest <= HUFF_MAX_BITS)
+            return;
+        for (size_t i = 0; i < n; ++i) // too deep, flatten the counts and try again. it ends balanced at worst.
+            freq[i] = freq[i] ? (freq[i] + 1) / 2 : 0;
+    }
+}
+
+// canonical codes, bit-reversed so they can go out least significant bit first.
+inline void HuffCodes(const uint8_t* lengths, size_t n, uint16_t* codes) {
+    uint32_t count[HUFF_MAX_BITS + 1] = {}, next[HUFF_MAX_BITS + 2] = {};
+    for (size_t i = 0; i < n; ++i)
+        count[lengths[i]]++;
+    count[0] = 0;
+    for (unsigned bits = 1; bits <= HUFF_MAX_BITS; ++bits)
+        next[bits + 1] = (next[bits] + count[bits]) << 1;
+    for (size_t i = 0; i < n; ++i) {
+        unsigned len = lengths[i];
+        if (!len)
+            continue;
+        uint32_t code = next[len]++, reversed = 0;
+        for (unsigned b = 0; b < len; ++b)
+            reversed |= ((code >> b) & 1) << (len - 1 - b);
+        codes[i] = static_cast<uint16_t>(reversed);
+    }
+}
+
+// lookup table over the next 'bits' input bits, each entry is symbol << 4 | code length. 0 marks a hole.
+inline unsigned HuffTable(const uint8_t* lengths, size_t n, std::vector<uint32_t>& table) {
+    unsigned bits = 0;
+    uint64_t kraft = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (lengths[i]) {
+            bits = std::max<unsigned>(bits, lengths[i]);
+            kraft += 1ull << (HUFF_MAX_BITS - lengths[i]);
+        }
+    }
+    if (kraft > (1ull << HUFF_MAX_BITS))
+        throw std::runtime_error("corrupted archive: invalid huffman table.");
+    uint16_t codes[HUFF_LITLEN];
+    HuffCodes(lengths, n, codes);
+    table.assign(size_t(1) << bits, 0);
+    for (size_t i = 0; i < n; ++i) {
+        unsigned len = lengths[i];
+        if (!len)
+            continue;
+        for (size_t at = codes[i]; at < table.size(); at += size_t(1) << len)
+            table[at] = static_cast<uint32_t>(i << 4 | len);
+    }
+    return bits;
+}
+
+inline unsigned OffsetBucket(uint32_t offset) { // bit length - 1, offsets are never 0.
+    unsigned bucket = 0;
+    while (offset >> (bucket + 1))
+        bucket++;
+    return bucket;
+}
+
+// walks our byte-aligned tokens, literal runs [count < 128][bytes] and matches [128 + len - 3][offset:2 big endian].
+template <typename Literal, typename Match>
+void ForEachToken(std::span<const uint8_t> lzss, Literal&& literal, Match&& match) {
+    size_t pos = 0, size = lzss.size();
+    while (pos < size) {
+        uint8_t cmd = lzss[pos++];
+        if (cmd < 128) {
+            if (cmd > size - pos)
+                throw std::runtime_error("internal error: truncated literal run.");
+            for (size_t i = 0; i < cmd; ++i)
+                literal(lzss[pos + i]);
+            pos += cmd;
+        }
+        else {
+            if (size - pos < 2)
+                throw std::runtime_error("internal error: truncated match.");
+            uint32_t offset = (static_cast<uint32_t>(lzss[pos]) << 8) | lzss[pos + 1];
+            pos += 2;
+            if (offset == 0)
+                throw std::runtime_error("internal error: zero match offset.");
+            match(static_cast<size_t>(cmd - 128) + HUFF_MIN_MATCH, offset);
+        }
+    }
+}
+
+// 'out' is overwritten, its capacity is kept for the next block.
+inline void HuffEncodeTokens(std::span<const uint8_t> lzss, std::vector<uint8_t>& out) {
+    uint32_t litlen_freq[HUFF_LITLEN] = {}, offset_freq[HUFF_OFFSETS] = {};
+    ForEachToken(lzss,
+        [&](uint8_t byte) { litlen_freq[byte]++; },
+        [&](size_t length, uint32_t offset) {
+            litlen_freq[256 + length - HUFF_MIN_MATCH]++;
+            offset_freq[OffsetBucket(offset)]++;
+        });
+    uint8_t lengths[HUFF_LITLEN + HUFF_OFFSETS];
+    HuffLengths(litlen_freq, HUFF_LITLEN, lengths);
+    HuffLengths(offset_freq, HUFF_OFFSETS, lengths + HUFF_LITLEN);
+    uint16_t codes[HUFF_LITLEN + HUFF_OFFSETS] = {};
+    HuffCodes(lengths, HUFF_LITLEN, codes);
+    HuffCodes(lengths + HUFF_LITLEN, HUFF_OFFSETS, codes + HUFF_LITLEN);
+    out.clear();
+    out.reserve(HUFF_HEADER_SIZE + 2 * lzss.size() + 8); // 15-bit codes at worst, under two bytes per token byte.
+    for (size_t i = 0; i < HUFF_LITLEN + HUFF_OFFSETS; i += 2)
+        out.push_back(static_cast<uint8_t>(lengths[i] | (lengths[i + 1] << 4)));
+    uint64_t bits = 0;
+    unsigned count = 0;
+    auto Put = [&](uint32_t value, unsigned n) {
+        bits |= static_cast<uint64_t>(value) << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back(static_cast<uint8_t>(bits));
+            bits >>= 8;
+            count -= 8;
+        }
+        };
+    ForEachToken(lzss,
+        [&](uint8_t byte) { Put(codes[byte], lengths[byte]); },
+        [&](size_t length, uint32_t offset) {
+            size_t sym = 256 + length - HUFF_MIN_MATCH;
+            Put(codes[sym], lengths[sym]);
+            unsigned bucket = OffsetBucket(offset);
+            Put(codes[HUFF_LITLEN + bucket], lengths[HUFF_LITLEN + bucket]);
+            Put(offset & ((1u << bucket) - 1), bucket);
+        });
+    if (count)
+        out.push_back(static_cast<uint8_t>(bits));
+}
+
+inline std::vector<uint8_t> HuffEncodeTokens(std::span<const uint8_t> lzss) {
+    std::vector<uint8_t> out;
+    HuffEncodeTokens(lzss, out);
+    return out;
+}
+
+class HuffDecoder { // keeps its lookup tables between blocks.
+public:
+    size_t DecodeInto(std::span<const uint8_t> in, uint8_t* out, size_t out_size) { // returns bytes written.
+        if (in.size() < HUFF_HEADER_SIZE)
+            throw std::runtime_error("corrupted archive: huffman header too short.");
+        uint8_t lengths[HUFF_LITLEN + HUFF_OFFSETS];
+        for (size_t i = 0; i < HUFF_HEADER_SIZE; ++i) {
+            lengths[2 * i] = in[i] & 0xF;
+            lengths[2 * i + 1] = in[i] >> 4;
+        }
+        unsigned litlen_bits = HuffTable(lengths, HUFF_LITLEN, litlen_table_);
+        unsigned offset_bits = HuffTable(lengths + HUFF_LITLEN, HUFF_OFFSETS, offset_table_);
+        const uint8_t* p = in.data() + HUFF_HEADER_SIZE;
+        const uint8_t* end = in.data() + in.size();
+        uint64_t bits = 0;
+        unsigned count = 0;
+        size_t padding = 0; // zero bytes fed in past the end, using any of them means the stream was cut short.
+        auto Refill = [&]() {
+            if (count > 56)
+                return;
+            if (end - p >= 8) { // a whole word, only the bytes that fit are consumed.
+                bits |= LoadLE64(p) << count;
+                p += (63 - count) >> 3;
+                count |= 56;
+                return;
+            }
+            while (count <= 56) {
+                uint64_t byte = 0;
+                if (p < end)
+                    byte = *p++;
+                else
+                    padding++;
+                bits |= byte << count;
+                count += 8;
+            }
+            };
+        auto Symbol = [&](const std::vector<uint32_t>& table, unsigned table_bits) {
+            uint32_t entry = table[bits & ((uint64_t(1) << table_bits) - 1)];
+            unsigned len = entry & 0xF;
+            if (!len)
+                throw std::runtime_error("corrupted archive: invalid huffman code.");
+            bits >>= len;
+            count -= len;
+            return entry >> 4;
+            };
+        size_t n = 0;
+        while (n < out_size) {
+            Refill(); // 56+ bits, enough for a length, an offset bucket and its low bits.
+            uint32_t sym = Symbol(litlen_table_, litlen_bits);
+            if (sym < 256) {
+                out[n++] = static_cast<uint8_t>(sym);
+                continue;
+            }
+            size_t length = sym - 256 + HUFF_MIN_MATCH;
+            unsigned bucket = Symbol(offset_table_, offset_bits);
+            size_t offset = (size_t(1) << bucket) | static_cast<size_t>(bits & ((uint64_t(1) << bucket) - 1));
+            bits >>= bucket;
+            count -= bucket;
+            if (offset > n || length > out_size - n)
+                throw std::runtime_error("corrupted archive: invalid match in huffman stream.");
+            CopyMatchWild(out + n, offset, length, out_size - n);
+            n += length;
+        }
+        if (padding * 8 > count)
+            throw std::runtime_error("corrupted archive: huffman stream too short.");
+        return n;
+    }
+private:
+    std::vector<uint32_t> litlen_table_, offset_table_;
+};
+
+inline size_t HuffDecodeInto(std::span<const uint8_t> in, uint8_t* out, size_t out_size) { // returns bytes written.
+    return HuffDecoder().DecodeInto(in, out, out_size);
+}
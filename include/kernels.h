@@ -0,0 +1,141 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(_M_X64)
+#define FILEPACKER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+// includes
+
+#if defined(FILEPACKER_X86) && !defined(_MSC_VER)
+#define FILEPACKER_AVX2 __attribute__((target("avx2")))
+#else
+#define FILEPACKER_AVX2
+#endif
+
+// the byte loops of the codec, a word or a vector at a time. plain c++ works everywhere, the avx2 variants are picked
+// at runtime on cpus that have it, the binary itself is built for the baseline.
+#ifdef FILEPACKER_X86
+inline bool CpuHasAvx2() { // the cpu has to have it and the os has to save the ymm registers.
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27))) // osxsave
+        return false;
+    if ((_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#else
+inline bool CpuHasAvx2() {
+    return false;
+}
+#endif
+
+inline uint64_t LoadLE64(const uint8_t* p) {
+    if constexpr (std::endian::native == std::endian::big) {
+        uint64_t v = 0;
+        for (int i = 0; i < 8; ++i)
+            v |= static_cast<uint64_t>(p[i]) << (8 * i);
+        return v;
+    }
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+struct WordKernel {
+    // length of the common prefix of 'a' and 'b', at most 'limit'. 8 bytes at a time, the first byte that differs is
+    // the lowest set bit of the xor.
+    static size_t MatchLength(const uint8_t* a, const uint8_t* b, size_t limit) {
+        size_t n = 0;
+        for (; n + 8 <= limit; n += 8) {
+            uint64_t diff = LoadLE64(a + n) ^ LoadLE64(b + n);
+            if (diff)
+                return n + (std::countr_zero(diff) >> 3);
+        }
+        for (; n < limit && a[n] == b[n]; ++n) {}
+        return n;
+    }
+};
+
+#ifdef FILEPACKER_X86
+struct Avx2Kernel {
+    FILEPACKER_AVX2 static size_t MatchLength(const uint8_t* a, const uint8_t* b, size_t limit) { // 32 bytes a compare.
+        size_t n = 0;
+        for (; n + 32 <= limit; n += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + n));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + n));
+            uint32_t differ = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)));
+            if (differ)
+                return n + std::countr_zero(differ);
+        }
+        return n + WordKernel::MatchLength(a + n, b + n, limit - n);
+    }
+};
+#else
+using Avx2Kernel = WordKernel;
+#endif
+
+// copies 'length' bytes from 'offset' back to 'dst'. a copy longer than its offset repeats the bytes it has just
+// written, the first copy lays down one period and every next one doubles what can be copied at once, so a long run
+// costs a few memcpy calls instead of a byte loop.
+inline void CopyMatch(uint8_t* dst, size_t offset, size_t length) {
+    const uint8_t* src = dst - offset;
+    if (offset >= length) {
+        std::memcpy(dst, src, length);
+        return;
+    }
+    while (length > offset) {
+        std::memcpy(dst, src, offset);
+        dst += offset;
+        length -= offset;
+        offset *= 2;
+    }
+    std::memcpy(dst, src, length);
+}
+
+// the same copy for the short matches of the token decoders, 'room' is what may be written at 'dst'. with an offset
+// of 16 or more and 16 bytes to spare it goes 16 bytes at a time and may run past the match, the bytes after it are
+// written again by whatever comes next. a chunk never reads what it writes itself, so the overlap stays exact.
+inline void CopyMatchWild(uint8_t* dst, size_t offset, size_t length, size_t room) {
+    if (offset >= 16 && length + 16 <= room) {
+        const uint8_t* src = dst - offset;
+        for (size_t i = 0; i < length; i += 16)
+            std::memcpy(dst + i, src + i, 16);
+        return;
+    }
+    CopyMatch(dst, offset, length);
+}
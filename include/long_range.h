@@ -0,0 +1,94 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <vector>
+#include "kernels.h"
+// includes
+
+// long-range matches for -window. the lzss tokens reach 64 KiB back and 130 bytes far, repeats in logs and disk
+// images sit megabytes apart and run for kilobytes. a rolling hash over LONG_MIN_MATCH bytes picks anchors by content,
+// about one every 2^LONG_ANCHOR_BITS positions, so both copies of a repeat get the same anchors wherever they are.
+// each anchor remembers the newest position it was seen at, a hit is checked and then grown in both directions.
+constexpr size_t LONG_MIN_MATCH = 64; // rolling hash span, and the shortest long match.
+constexpr unsigned LONG_ANCHOR_BITS = 3;
+constexpr uint64_t LONG_HASH_PRIME = 0x100000001B3ull;
+
+struct LongMatch {
+    size_t pos = 0; // where the copy starts in the block.
+    size_t offset = 0; // how far back it copies from, may be less than the length.
+    size_t length = 0;
+};
+
+class LongMatcher {
+public:
+    // the matches of 'in' in order, none overlapping. 'window' caps the offset.
+    void Find(std::span<const uint8_t> in, size_t window, std::vector<LongMatch>& matches) {
+        matches.clear();
+        const size_t size = in.size();
+        if (size < 2 * LONG_MIN_MATCH)
+            return;
+        unsigned bits = 10;
+        while (bits < 22 && (size_t(1) << (bits + LONG_ANCHOR_BITS)) < size)
+            bits++;
+        table_.assign(size_t(1) << bits, NONE);
+        uint64_t power = 1; // prime^LONG_MIN_MATCH, takes the byte leaving the span back out.
+        for (size_t i = 0; i < LONG_MIN_MATCH; ++i)
+            power *= LONG_HASH_PRIME;
+        const uint64_t anchor_mask = (uint64_t(1) << LONG_ANCHOR_BITS) - 1;
+        const uint8_t* data = in.data();
+        uint64_t hash = 0;
+        size_t cursor = 0; // everything before it is in a match or left for lzss.
+        for (size_t i = 0; i < size; ++i) {
+            hash = hash * LONG_HASH_PRIME + data[i] + 1;
+            if (i < LONG_MIN_MATCH - 1)
+                continue;
+            if (i >= LONG_MIN_MATCH)
+                hash -= (data[i - LONG_MIN_MATCH] + 1) * power;
+            uint64_t mixed = hash * 0x9E3779B97F4A7C15ull;
+            if ((mixed >> 24) & anchor_mask)
+                continue;
+            size_t start = i + 1 - LONG_MIN_MATCH;
+            uint32_t& slot = table_[mixed >> (64 - bits)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(start);
+            if (candidate == NONE || start < cursor || start - candidate > window)
+                continue;
+            if (std::memcmp(data + candidate, data + start, LONG_MIN_MATCH) != 0)
+                continue; // another span with the same anchor slot.
+            size_t length = LONG_MIN_MATCH + WordKernel::MatchLength(data + candidate + LONG_MIN_MATCH,
+                data + start + LONG_MIN_MATCH, size - start - LONG_MIN_MATCH);
+            while (start > cursor && candidate > 0 && data[start - 1] == data[candidate - 1]) {
+                start--;
+                candidate--;
+                length++;
+            }
+            matches.push_back({ start, start - candidate, length });
+            cursor = start + length;
+        }
+    }
+private:
+    static constexpr uint32_t NONE = UINT32_MAX; // positions fit 32 bits, LONG_WINDOW_MAX keeps blocks below 4 GiB.
+    std::vector<uint32_t> table_;
+};
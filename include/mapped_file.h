@@ -0,0 +1,187 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+// includes
+
+using ByteView = std::span<const uint8_t>; // bytes owned by someone else, a mapping or a vector.
+
+// a whole file mapped into memory. opened read-only, or made with Create at a fixed size and written in place.
+// empty files are never mapped, data() is null and size() is 0 for them.
+class MappedFile {
+public:
+    MappedFile() = default;
+
+    explicit MappedFile(const std::string& file) {
+        Open(file, 0, false);
+    }
+
+    static MappedFile Create(const std::string& file, uint64_t size) { // truncates, then sizes the file up front.
+        MappedFile mapped;
+        mapped.Open(file, size, true);
+        return mapped;
+    }
+
+    MappedFile(MappedFile&& other) noexcept {
+        Swap(other);
+    }
+
+    MappedFile& operator=(MappedFile&& other) noexcept {
+        if (this != &other) {
+            Close();
+            Swap(other);
+        }
+        return *this;
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        Close();
+    }
+
+    uint8_t* data() { return data_; }
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    ByteView view() const { return ByteView(data_, size_); }
+
+    void Close() {
+#ifdef _WIN32
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE)
+            CloseHandle(file_);
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+#else
+        if (data_)
+            munmap(data_, size_);
+        if (fd_ >= 0)
+            ::close(fd_);
+        fd_ = -1;
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+private:
+    void Swap(MappedFile& other) noexcept {
+        std::swap(data_, other.data_);
+        std::swap(size_, other.size_);
+#ifdef _WIN32
+        std::swap(file_, other.file_);
+        std::swap(mapping_, other.mapping_);
+#else
+        std::swap(fd_, other.fd_);
+#endif
+    }
+
+    void Open(const std::string& file, uint64_t size, bool writable) {
+#ifdef _WIN32
+        file_ = CreateFileA(file.c_str(), writable ? (GENERIC_READ | GENERIC_WRITE) : GENERIC_READ, FILE_SHARE_READ,
+            nullptr, writable ? CREATE_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Error opening file: " + file);
+        if (!writable) {
+            LARGE_INTEGER file_size;
+            if (!GetFileSizeEx(file_, &file_size))
+                Fail("Error reading file: " + file);
+            size = static_cast<uint64_t>(file_size.QuadPart);
+        }
+        if (size == 0)
+            return;
+        if (size > std::numeric_limits<size_t>::max())
+            Fail("file too large to map: " + file);
+        // for a new file the mapping sets its size, no separate resize needed.
+        mapping_ = CreateFileMappingA(file_, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+            static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+        if (!mapping_)
+            Fail("Error mapping file: " + file);
+        data_ = static_cast<uint8_t*>(MapViewOfFile(mapping_, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, static_cast<SIZE_T>(size)));
+        if (!data_)
+            Fail("Error mapping file: " + file);
+#else
+        fd_ = writable ? ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644) : ::open(file.c_str(), O_RDONLY);
+        if (fd_ < 0)
+            throw std::runtime_error("Error opening file: " + file);
+        if (writable) {
+            if (size > static_cast<uint64_t>(std::numeric_limits<off_t>::max()) || ::ftruncate(fd_, static_cast<off_t>(size)) != 0)
+                Fail("Error writing file: " + file);
+#ifdef __linux__
+            // reserve the blocks now, a full disk is an exception here instead of a SIGBUS in the middle of a copy.
+            if (size > 0 && posix_fallocate(fd_, 0, static_cast<off_t>(size)) != 0)
+                Fail("Error writing file: " + file);
+#endif
+        }
+        else {
+            struct stat st;
+            if (::fstat(fd_, &st) != 0)
+                Fail("Error reading file: " + file);
+            size = static_cast<uint64_t>(st.st_size);
+        }
+        if (size == 0)
+            return;
+        if (size > std::numeric_limits<size_t>::max())
+            Fail("file too large to map: " + file);
+        void* p = mmap(nullptr, static_cast<size_t>(size), writable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED)
+            Fail("Error mapping file: " + file);
+        data_ = static_cast<uint8_t*>(p);
+#endif
+        size_ = static_cast<size_t>(size);
+    }
+
+    [[noreturn]] void Fail(const std::string& message) {
+        Close();
+        throw std::runtime_error(message);
+    }
+
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+#ifdef _WIN32
+    HANDLE file_ = INVALID_HANDLE_VALUE;
+    HANDLE mapping_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
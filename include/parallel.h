@@ -0,0 +1,279 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+// includes
+
+inline size_t DefaultJobs() { // one worker per core, never zero.
+    unsigned n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+}
+
+// runs fn(0..count-1) on 'jobs' threads. every worker pulls the next index as soon as it is free,
+// so a few heavy items dont leave the other cores idle. the first exception is rethrown to the caller.
+template <typename Fn>
+void ParallelFor(size_t count, size_t jobs, Fn&& fn) {
+    jobs = std::min(jobs, count);
+    if (jobs <= 1) {
+        for (size_t i = 0; i < count; ++i)
+            fn(i);
+        return;
+    }
+    std::atomic<size_t> next{ 0 };
+    std::exception_ptr error;
+    std::mutex error_lock;
+    auto worker = [&]() {
+        while (true) {
+            size_t i = next.fetch_add(1);
+            if (i >= count)
+                return;
+            try {
+                fn(i);
+            }
+            catch (...) {
+                std::lock_guard<std::mutex> lock(error_lock);
+                if (!error)
+                    error = std::current_exception();
+                next.store(count); // stop handing out work.
+            }
+        }
+        };
+    std::vector<std::thread> pool;
+    for (size_t j = 1; j < jobs; ++j)
+        pool.emplace_back(worker);
+    worker();
+    for (auto& t : pool)
+        t.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// a fixed number of slots between threads. Push waits while it is full, Pop while it is empty. after Close the items
+// already in still come out, Push refuses new ones and Pop returns false once it is drained. Close(true) drops them.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(std::max<size_t>(capacity, 1)) {}
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+    bool Push(T item) {
+        std::unique_lock<std::mutex> lock(lock_);
+        not_full_.wait(lock, [this]() { return closed_ || items_.size() < capacity_; });
+        if (closed_)
+            return false;
+        items_.push_back(std::move(item));
+        not_empty_.notify_one();
+        return true;
+    }
+    bool Pop(T& item) {
+        std::unique_lock<std::mutex> lock(lock_);
+        not_empty_.wait(lock, [this]() { return closed_ || !items_.empty(); });
+        if (items_.empty())
+            return false;
+        item = std::move(items_.front());
+        items_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+    void Close(bool drop = false) {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            closed_ = true;
+            if (drop)
+                items_.clear();
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+private:
+    size_t capacity_;
+    std::deque<T> items_;
+    std::mutex lock_;
+    std::condition_variable not_full_, not_empty_;
+    bool closed_ = false;
+};
+
+// two stages over one queue: 'producers' threads run produce(0..count-1, queue) and push items, 'consumers' threads
+// pop them into consume(item). at most 'depth' items wait in between, so the producers stay ahead of the consumers
+// without running away with the memory. a producer should stop when Push returns false. the first exception stops
+// both sides and is rethrown to the caller.
+template <typename T, typename Produce, typename Consume>
+void Pipeline(size_t count, size_t producers, size_t consumers, size_t depth, Produce&& produce, Consume&& consume) {
+    producers = std::max<size_t>(std::min(producers, count), 1);
+    consumers = std::max<size_t>(consumers, 1);
+    BoundedQueue<T> queue(depth);
+    std::atomic<size_t> next{ 0 };
+    std::atomic<size_t> running{ producers };
+    std::exception_ptr error;
+    std::mutex error_lock;
+    auto fail = [&]() {
+        {
+            std::lock_guard<std::mutex> lock(error_lock);
+            if (!error)
+                error = std::current_exception();
+        }
+        next.store(count); // stop handing out work.
+        queue.Close(true);
+        };
+    auto producer = [&]() {
+        try {
+            while (true) {
+                size_t i = next.fetch_add(1);
+                if (i >= count)
+                    break;
+                produce(i, queue);
+            }
+        }
+        catch (...) {
+            fail();
+        }
+        if (running.fetch_sub(1) == 1)
+            queue.Close(); // the last one out, the consumers drain what is left.
+        };
+    auto consumer = [&]() {
+        T item;
+        try {
+            while (queue.Pop(item))
+                consume(item);
+        }
+        catch (...) {
+            fail();
+        }
+        };
+    std::vector<std::thread> pool;
+    for (size_t j = 0; j < producers; ++j)
+        pool.emplace_back(producer);
+    for (size_t j = 1; j < consumers; ++j)
+        pool.emplace_back(consumer);
+    consumer();
+    for (auto& t : pool)
+        t.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+// puts back in order what the consumers of a Pipeline finish out of order. an item is numbered by its task and its
+// place in the task, a task is complete once Finish tells how many items it had. 'write' gets them one at a time in
+// that order, on whichever thread hands in the next one due. a producer calls Admit before it holds an item, that
+// waits while 'window' items are unwritten. the task being written only counts its own, it is never held back by the
+// ones queued behind it, and a slow item there stops it after 'window' more. so at most two windows of items are
+// around at once. an item admitted but never put is given back when its task finishes. Close lets everyone go after a
+// failure, a throwing 'write' closes it too.
+template <typename T, typename Write>
+class OrderedWriter {
+public:
+    OrderedWriter(size_t tasks, size_t window, Write& write)
+        : counts_(tasks, NONE), admitted_(tasks, 0), unwritten_(tasks, 0), window_(std::max<size_t>(window, 1)), write_(write) {}
+    OrderedWriter(const OrderedWriter&) = delete;
+    OrderedWriter& operator=(const OrderedWriter&) = delete;
+    bool Admit(size_t task) { // false once closed.
+        std::unique_lock<std::mutex> lock(lock_);
+        admit_.wait(lock, [&]() { return closed_ || (task == head_ ? unwritten_[task] : pending_) < window_; });
+        if (closed_)
+            return false;
+        pending_++;
+        admitted_[task]++;
+        unwritten_[task]++;
+        return true;
+    }
+    void Put(size_t task, size_t index, T item) {
+        std::unique_lock<std::mutex> lock(lock_);
+        ready_.emplace(std::make_pair(task, index), std::move(item));
+        Drain(lock);
+    }
+    void Finish(size_t task, size_t count) {
+        std::unique_lock<std::mutex> lock(lock_);
+        counts_[task] = count;
+        size_t unused = admitted_[task] > count ? admitted_[task] - count : 0;
+        unwritten_[task] -= unused;
+        pending_ -= unused;
+        admit_.notify_all();
+        Drain(lock);
+    }
+    void Close() {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            closed_ = true;
+        }
+        admit_.notify_all();
+    }
+    bool Done() { // every task written.
+        std::lock_guard<std::mutex> lock(lock_);
+        return head_ == counts_.size();
+    }
+private:
+    static constexpr size_t NONE = SIZE_MAX; // a task still running.
+    void Drain(std::unique_lock<std::mutex>& lock) {
+        if (writing_)
+            return; // the thread writing picks it up before it lets go.
+        writing_ = true;
+        try {
+            while (true) {
+                while (head_ < counts_.size() && counts_[head_] == next_) {
+                    head_++;
+                    next_ = 0;
+                    admit_.notify_all();
+                }
+                auto found = ready_.find({ head_, next_ });
+                if (found == ready_.end())
+                    break;
+                T item = std::move(found->second);
+                ready_.erase(found);
+                lock.unlock();
+                write_(item);
+                lock.lock();
+                next_++;
+                pending_--;
+                unwritten_[head_]--;
+                admit_.notify_all();
+            }
+        }
+        catch (...) {
+            if (!lock.owns_lock())
+                lock.lock();
+            writing_ = false;
+            closed_ = true;
+            admit_.notify_all();
+            throw;
+        }
+        writing_ = false;
+    }
+    std::vector<size_t> counts_; // items per task, by task.
+    std::vector<size_t> admitted_, unwritten_; // by task.
+    size_t window_;
+    Write& write_;
+    std::map<std::pair<size_t, size_t>, T> ready_; // finished, waiting for their turn.
+    size_t head_ = 0, next_ = 0; // the item due next.
+    size_t pending_ = 0; // admitted and not written yet.
+    bool writing_ = false, closed_ = false;
+    std::mutex lock_;
+    std::condition_variable admit_;
+};
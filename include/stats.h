@@ -0,0 +1,160 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+// includes
+
+// counters filled in by the pipeline while it runs. workers add to them directly, so everything is atomic.
+// times are summed over all threads, with -j 8 a stage can take more seconds than the run did.
+struct PackStats {
+    std::atomic<uint64_t> total{ 0 }; // raw bytes this run will go through, known up front.
+    std::atomic<uint64_t> done{ 0 }; // raw bytes compressed or decoded so far.
+    std::atomic<uint64_t> lzss_ns{ 0 }, entropy_ns{ 0 }, xor_ns{ 0 }, io_ns{ 0 };
+    std::atomic<uint64_t> matches{ 0 }, match_bytes{ 0 }, literals{ 0 }; // from Compress.
+    std::atomic<uint64_t> raw_bytes{ 0 }, lzss_bytes{ 0 }, entropy_bytes{ 0 }, archive_bytes{ 0 };
+    std::atomic<uint64_t> mode_blocks[6] = {}; // blocks per BlockMode.
+    std::atomic<uint64_t> dedup_chunks{ 0 }, dedup_bytes{ 0 }; // chunks a folder archive already had, not compressed again.
+};
+
+class StageTimer { // adds the time between construction and destruction to one of the PackStats clocks.
+public:
+    StageTimer(PackStats* stats, std::atomic<uint64_t> PackStats::* clock) : stats_(stats), clock_(clock) {
+        if (stats_)
+            start_ = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if (stats_)
+            (stats_->*clock_) += static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start_).count());
+    }
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+private:
+    PackStats* stats_;
+    std::atomic<uint64_t> PackStats::* clock_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+inline void AddStat(PackStats* stats, std::atomic<uint64_t> PackStats::* counter, uint64_t n) {
+    if (stats)
+        (stats->*counter) += n;
+}
+
+inline void Progress(uint64_t done, uint64_t total, double seconds) { // one redraw of the bar.
+    static const char anim[] = "|/-\\";
+    static int frame = 0;
+    const int bar_width = 30;
+    done = std::min(done, total); // a file that grew since it was listed would run the bar past its end.
+    int percent = total ? static_cast<int>(done * 100 / total) : 0;
+    int num_dashes = (percent * bar_width) / 100;
+    double mb_s = seconds > 0 ? done / 1048576.0 / seconds : 0.0;
+    std::fprintf(stderr, "\r[%c] %s%d%%%s [|] %.2f MB/s   ", anim[frame], std::string(num_dashes, '-').c_str(), percent,
+        std::string(bar_width - num_dashes, ' ').c_str(), mb_s);
+    std::fflush(stderr);
+    frame = (frame + 1) % 4;
+}
+
+// redraws the bar from the byte counters every so often on its own thread, until it goes out of scope.
+// it draws on stderr, so stdout stays clean for scripts. nothing is started when it is disabled or stderr isnt a
+// terminal, then it costs nothing.
+class ProgressMeter {
+public:
+    ProgressMeter(const PackStats& stats, bool enabled) : stats_(stats), start_(std::chrono::steady_clock::now()) {
+#ifdef _WIN32
+        enabled = enabled && _isatty(_fileno(stderr));
+#else
+        enabled = enabled && isatty(fileno(stderr));
+#endif
+        if (enabled)
+            thread_ = std::thread([this]() { Run(); });
+    }
+    ~ProgressMeter() {
+        if (!thread_.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+        Draw();
+        std::fprintf(stderr, "\n");
+    }
+    ProgressMeter(const ProgressMeter&) = delete;
+    ProgressMeter& operator=(const ProgressMeter&) = delete;
+private:
+    void Run() {
+        std::unique_lock<std::mutex> lock(lock_);
+        while (!wake_.wait_for(lock, std::chrono::milliseconds(100), [this]() { return stop_; }))
+            Draw();
+    }
+    void Draw() {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+        Progress(stats_.done.load(), stats_.total.load(), seconds);
+    }
+    const PackStats& stats_;
+    std::chrono::steady_clock::time_point start_;
+    std::thread thread_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+};
+
+inline void PrintStats(const PackStats& stats, double wall_seconds) { // the --stats report.
+    auto Seconds = [](const std::atomic<uint64_t>& ns) { return ns.load() / 1e9; };
+    auto Ratio = [](uint64_t a, uint64_t b) { return b ? 100.0 * a / b : 0.0; };
+    double busy = Seconds(stats.lzss_ns) + Seconds(stats.entropy_ns) + Seconds(stats.xor_ns) + Seconds(stats.io_ns);
+    std::printf("\nstage     seconds    share   (summed over threads, wall %.3f s)\n", wall_seconds);
+    const std::pair<const char*, const std::atomic<uint64_t>*> stages[] = {
+        { "lzss", &stats.lzss_ns }, { "entropy", &stats.entropy_ns }, { "xor", &stats.xor_ns }, { "io", &stats.io_ns } };
+    for (const auto& [name, ns] : stages)
+        std::printf("%-8s %8.3f  %6.2f%%\n", name, Seconds(*ns), busy > 0 ? 100.0 * Seconds(*ns) / busy : 0.0);
+    uint64_t matches = stats.matches, literals = stats.literals;
+    if (matches || literals) {
+        std::printf("matches  %llu (avg length %.2f), literals %llu\n", static_cast<unsigned long long>(matches),
+            matches ? static_cast<double>(stats.match_bytes) / matches : 0.0, static_cast<unsigned long long>(literals));
+    }
+    std::printf("blocks   lzss+huff %llu, lzss+zlib %llu, zlib %llu, lzss %llu, stored %llu, long %llu\n",
+        static_cast<unsigned long long>(stats.mode_blocks[4]), static_cast<unsigned long long>(stats.mode_blocks[0]),
+        static_cast<unsigned long long>(stats.mode_blocks[2]), static_cast<unsigned long long>(stats.mode_blocks[3]),
+        static_cast<unsigned long long>(stats.mode_blocks[1]), static_cast<unsigned long long>(stats.mode_blocks[5]));
+    if (stats.dedup_chunks) {
+        std::printf("dedup    %llu chunks, %llu bytes\n", static_cast<unsigned long long>(stats.dedup_chunks),
+            static_cast<unsigned long long>(stats.dedup_bytes));
+    }
+    uint64_t raw = stats.raw_bytes, lzss = stats.lzss_bytes, entropy = stats.entropy_bytes, archive = stats.archive_bytes;
+    std::printf("bytes    raw %llu, lzss %llu (%.2f%% of raw), entropy %llu (%.2f%% of lzss), archive %llu (%.2f%% of raw)\n",
+        static_cast<unsigned long long>(raw), static_cast<unsigned long long>(lzss), Ratio(lzss, raw),
+        static_cast<unsigned long long>(entropy), Ratio(entropy, lzss), static_cast<unsigned long long>(archive), Ratio(archive, raw));
+}
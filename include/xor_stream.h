@@ -0,0 +1,150 @@
+/*
+ * Copyright 2018-2025 Alnicke
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+// includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <vector>
+#include "kernels.h"
+// includes
+
+// xor kernels, dst[i] = src[i] ^ ks[i]. src may be dst. unaligned loads everywhere, the buffers come from anywhere.
+using XorKernel = void (*)(const uint8_t* src, const uint8_t* ks, uint8_t* dst, size_t len);
+
+inline void XorScalar(const uint8_t* src, const uint8_t* ks, uint8_t* dst, size_t len) { // a word at a time, then the tail.
+    size_t i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t a, b;
+        memcpy(&a, src + i, 8);
+        memcpy(&b, ks + i, 8);
+        a ^= b;
+        memcpy(dst + i, &a, 8);
+    }
+    for (; i < len; ++i)
+        dst[i] = src[i] ^ ks[i];
+}
+
+#ifdef FILEPACKER_X86
+inline void XorSse2(const uint8_t* src, const uint8_t* ks, uint8_t* dst, size_t len) { // sse2 is always there on x86-64.
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+        __m128i a2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32));
+        __m128i a3 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48));
+        a0 = _mm_xor_si128(a0, _mm_loadu_si128(reinterpret_cast<const __m128i*>(ks + i)));
+        a1 = _mm_xor_si128(a1, _mm_loadu_si128(reinterpret_cast<const __m128i*>(ks + i + 16)));
+        a2 = _mm_xor_si128(a2, _mm_loadu_si128(reinterpret_cast<const __m128i*>(ks + i + 32)));
+        a3 = _mm_xor_si128(a3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(ks + i + 48)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), a0);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 16), a1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 32), a2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 48), a3);
+    }
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        a = _mm_xor_si128(a, _mm_loadu_si128(reinterpret_cast<const __m128i*>(ks + i)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), a);
+    }
+    XorScalar(src + i, ks + i, dst + i, len - i);
+}
+
+inline FILEPACKER_AVX2 void XorAvx2(const uint8_t* src, const uint8_t* ks, uint8_t* dst, size_t len) {
+    size_t i = 0;
+    for (; i + 128 <= len; i += 128) {
+        __m256i a0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        __m256i a1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 32));
+        __m256i a2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 64));
+        __m256i a3 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i + 96));
+        a0 = _mm256_xor_si256(a0, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ks + i)));
+        a1 = _mm256_xor_si256(a1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ks + i + 32)));
+        a2 = _mm256_xor_si256(a2, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ks + i + 64)));
+        a3 = _mm256_xor_si256(a3, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ks + i + 96)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a0);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 32), a1);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 64), a2);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i + 96), a3);
+    }
+    for (; i + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        a = _mm256_xor_si256(a, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(ks + i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a);
+    }
+    XorScalar(src + i, ks + i, dst + i, len - i);
+}
+#endif
+
+inline XorKernel PickXorKernel() { // runtime dispatch, the best kernel this cpu runs.
+#ifdef FILEPACKER_X86
+    return CpuHasAvx2() ? XorAvx2 : XorSse2;
+#else
+    return XorScalar;
+#endif
+}
+
+inline XorKernel ActiveXorKernel() {
+    static const XorKernel kernel = PickXorKernel();
+    return kernel;
+}
+
+// the a_xor keystream, key[p % key_len] ^ (p & 0xFF), repeats every lcm(key_len, 256) bytes. it is built once for
+// that period and stored twice over, so any run of up to a period starting anywhere in it is contiguous.
+class KeyStream {
+public:
+    explicit KeyStream(const std::vector<uint8_t>& key) : key_(key) {
+        if (key.empty())
+            throw std::runtime_error("empty xor key.");
+        period_ = std::lcm(key.size(), static_cast<size_t>(256));
+        stream_.resize(2 * period_);
+        for (size_t p = 0; p < stream_.size(); ++p)
+            stream_[p] = key[p % key.size()] ^ static_cast<uint8_t>(p & 0xFF);
+    }
+
+    const std::vector<uint8_t>& key() const { return key_; }
+
+    // xors 'len' bytes that sit at stream position 'offset'. src may be dst.
+    void Apply(const uint8_t* src, uint8_t* dst, size_t len, uint64_t offset) const {
+        XorKernel kernel = ActiveXorKernel();
+        size_t at = static_cast<size_t>(offset % period_);
+        while (len > 0) {
+            size_t n = std::min(len, period_); // at + n stays inside the doubled stream, and 'at' comes back to itself.
+            kernel(src, stream_.data() + at, dst, n);
+            src += n;
+            dst += n;
+            len -= n;
+        }
+    }
+
+private:
+    std::vector<uint8_t> key_;
+    std::vector<uint8_t> stream_;
+    size_t period_ = 0;
+};
+
+inline const KeyStream& KeyStreamFor(const std::vector<uint8_t>& key) { // one cached stream per thread, rebuilt only when the key changes.
+    thread_local std::unique_ptr<KeyStream> cached;
+    if (!cached || cached->key() != key)
+        cached = std::make_unique<KeyStream>(key);
+    return *cached;
+}